@@ -0,0 +1,407 @@
+/*
+ * ctracer-bench: self-overhead benchmarks of ctracer
+ *
+ * Usage:
+ *   ctracer-bench [--filter <regex>] [--out <file>] [--list] [--baseline <file>]   (see ct::benchmark_main)
+ *   ctracer-bench --scaling                                                        (chunk allocation contention across threads)
+ *
+ * Benchmarks named *_x<N> execute N operations per sample, benchmarks with the same prefix only differ in one aspect
+ * (e.g. trace_x256_hot vs. trace_x256_rollover only differ in the chunk size) and are meant to be compared.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <ctracer/ChunkAllocator.hh>
+#include <ctracer/benchmark-parallel.hh>
+#include <ctracer/benchmark-suite.hh>
+#include <ctracer/benchmark.hh>
+#include <ctracer/compression.hh>
+#include <ctracer/diff.hh>
+#include <ctracer/scope.hh>
+#include <ctracer/system.hh>
+#include <ctracer/trace-config.hh>
+#include <ctracer/trace.hh>
+
+namespace
+{
+// 128 dwords: a chunk rollover every 13 TRACEs
+auto constexpr small_chunk_size = 128;
+
+// output of the exporter benchmarks (removed afterwards)
+char const* const export_file = "ctracer-bench.tmp";
+
+// pooled allocators so that chunk allocation does not measure malloc
+std::shared_ptr<ct::ChunkAllocator> const& default_allocator()
+{
+    static auto const a = ct::ChunkAllocator::create();
+    return a;
+}
+std::shared_ptr<ct::ChunkAllocator> const& small_allocator()
+{
+    static auto const a = ct::ChunkAllocator::create(small_chunk_size);
+    return a;
+}
+
+void traced_recursion(int depth)
+{
+    TRACE();
+    if (depth > 0)
+        traced_recursion(depth - 1);
+}
+
+// about 8 * outer_cnt begin/end pairs with two nesting levels and 3 locations
+ct::trace make_trace(int outer_cnt)
+{
+    ct::scope s("bench", default_allocator());
+    for (auto i = 0; i < outer_cnt; ++i)
+    {
+        TRACE("outer");
+        for (auto j = 0; j < 5; ++j)
+        {
+            TRACE("inner");
+        }
+        traced_recursion(1);
+    }
+    return s.trace();
+}
+
+struct counting_visitor : ct::visitor
+{
+    uint64_t count = 0;
+    void on_trace_start(ct::location const&, uint64_t, uint32_t) override { ++count; }
+};
+
+// re-encodes a trace in chunk format
+struct encoding_visitor : ct::visitor
+{
+    cc::vector<uint32_t> data;
+    void on_trace_start(ct::location const& loc, uint64_t cycles, uint32_t cpu) override
+    {
+        data.push_back(uint32_t(uint64_t(&loc)));
+        data.push_back(uint32_t(uint64_t(&loc) >> 32));
+        data.push_back(uint32_t(cycles));
+        data.push_back(uint32_t(cycles >> 32));
+        data.push_back(cpu);
+    }
+    void on_trace_end(uint64_t cycles, uint32_t cpu) override
+    {
+        data.push_back(CTRACER_END_VALUE);
+        data.push_back(uint32_t(cycles));
+        data.push_back(uint32_t(cycles >> 32));
+        data.push_back(cpu);
+    }
+};
+
+ct::benchmark_results benchmark_export(cc::function_ref<void()> write)
+{
+    ct::benchmark_config cfg;
+    cfg.max_runs = 100;
+    auto res = ct::benchmark(cfg, [&] { write(); });
+    std::remove(export_file);
+    return res;
+}
+}
+
+// =============== TRACE ===============
+
+// single TRACE, the scope is reset every 4096 samples so memory stays bounded (chunk rollover every ~7000 TRACEs)
+CT_BENCHMARK(trace_hot)
+{
+    ct::scope s("", default_allocator(), ct::chunk_allocation::lazy);
+    auto cnt = 0;
+    return ct::benchmark(
+        [&]
+        {
+            if (++cnt == 4096)
+            {
+                cnt = 0;
+                s.reset();
+            }
+            TRACE();
+        });
+}
+
+CT_BENCHMARK(trace_begin_end_hot)
+{
+    ct::scope s("", default_allocator(), ct::chunk_allocation::lazy);
+    auto cnt = 0;
+    return ct::benchmark(
+        [&]
+        {
+            if (++cnt == 4096)
+            {
+                cnt = 0;
+                s.reset();
+            }
+            TRACE_BEGIN();
+            TRACE_END();
+        });
+}
+
+// inside a null_scope: no clock read, no memory write
+CT_BENCHMARK(trace_discarded)
+{
+    ct::null_scope s;
+    return ct::benchmark([] { TRACE(); });
+}
+
+// average over 64 executions of which one is recorded
+CT_BENCHMARK(trace_sampled_64)
+{
+    ct::scope s("", default_allocator(), ct::chunk_allocation::lazy);
+    auto cnt = 0;
+    return ct::benchmark(
+        [&]
+        {
+            if (++cnt == 64 * 4096)
+            {
+                cnt = 0;
+                s.reset();
+            }
+            TRACE_SAMPLED(64);
+        });
+}
+
+// location disabled at runtime (see ct::disable_location)
+CT_BENCHMARK(trace_disabled)
+{
+    ct::disable_locations([](ct::location const& l) { return std::strcmp(l.name, "bench disabled") == 0; });
+    auto res = ct::benchmark([] { TRACE("bench disabled"); });
+    ct::enable_all_locations();
+    return res;
+}
+
+// scope with pooled 64k chunks: includes scope push/pop and one alloc_chunk
+CT_BENCHMARK(trace_x256_hot)
+{
+    return ct::benchmark(
+        []
+        {
+            ct::scope s("", default_allocator());
+            for (auto i = 0; i < 256; ++i)
+            {
+                TRACE();
+            }
+        });
+}
+
+// same as trace_x256_hot but with ~20 chunk rollovers
+CT_BENCHMARK(trace_x256_rollover)
+{
+    return ct::benchmark(
+        []
+        {
+            ct::scope s("", small_allocator());
+            for (auto i = 0; i < 256; ++i)
+            {
+                TRACE();
+            }
+        });
+}
+
+// =============== chunks and scopes ===============
+
+// alloc_chunk slow path (pooled allocator), includes one scope push/pop
+CT_BENCHMARK(alloc_chunk_x32)
+{
+    return ct::benchmark(
+        []
+        {
+            ct::scope s("", small_allocator());
+            for (auto i = 0; i < 32; ++i)
+                ct::detail::alloc_chunk();
+        });
+}
+
+CT_BENCHMARK(scope_push_pop)
+{
+    return ct::benchmark([] { ct::scope s("", default_allocator()); });
+}
+
+// no TRACE inside: no chunk is allocated
+CT_BENCHMARK(scope_push_pop_lazy)
+{
+    return ct::benchmark([] { ct::scope s("", default_allocator(), ct::chunk_allocation::lazy); });
+}
+
+// per-frame pattern: one long-lived scope, reset and 256 TRACEs per frame
+CT_BENCHMARK(scope_reset_trace_x256)
+{
+    ct::scope s("frame", default_allocator(), ct::chunk_allocation::lazy);
+    return ct::benchmark(
+        [&]
+        {
+            s.reset();
+            for (auto i = 0; i < 256; ++i)
+            {
+                TRACE();
+            }
+        });
+}
+
+CT_BENCHMARK(scope_push_pop_nested_x8)
+{
+    return ct::benchmark(
+        []
+        {
+            ct::scope s0("", default_allocator());
+            ct::scope s1("", default_allocator());
+            ct::scope s2("", default_allocator());
+            ct::scope s3("", default_allocator());
+            ct::scope s4("", default_allocator());
+            ct::scope s5("", default_allocator());
+            ct::scope s6("", default_allocator());
+            ct::scope s7("", default_allocator());
+        });
+}
+
+// copies ~1 MB of trace data
+CT_BENCHMARK(scope_trace_copy_1mb)
+{
+    ct::scope s("bench", default_allocator());
+    for (auto i = 0; i < (1 << 20) / 36; ++i)
+    {
+        TRACE();
+    }
+    return ct::benchmark([&] { return s.trace().empty(); });
+}
+
+// same data, but all full chunks are compressed (i.e. mostly measures decompression)
+CT_BENCHMARK(scope_trace_copy_1mb_compressed)
+{
+    ct::set_chunk_compression(true);
+    ct::scope s("bench", default_allocator());
+    for (auto i = 0; i < (1 << 20) / 36; ++i)
+    {
+        TRACE();
+    }
+    ct::set_chunk_compression(false);
+    ct::flush_chunk_compression();
+    return ct::benchmark([&] { return s.trace().empty(); });
+}
+
+// what the compression worker does per default chunk (256 kb)
+CT_BENCHMARK(compress_chunk_256k)
+{
+    encoding_visitor v;
+    ct::visit(make_trace(1 << 10), v);
+    cc::vector<uint8_t> out;
+    return ct::benchmark(
+        [&]
+        {
+            out.clear();
+            ct::detail::compress_trace_data(v.data.data(), v.data.size(), out);
+            return out.size();
+        });
+}
+
+// =============== analysis and export ===============
+
+// ~64k begin/end pairs
+CT_BENCHMARK(visit_decode_64k)
+{
+    auto const t = make_trace(1 << 13);
+    return ct::benchmark(
+        [&]
+        {
+            counting_visitor v;
+            ct::visit(t, v);
+            return v.count;
+        });
+}
+
+// window of ~1k events in the middle of ~128k events
+CT_BENCHMARK(slice_indexed_1k_of_64k)
+{
+    auto const t = make_trace(1 << 13);
+    auto const index = ct::build_trace_index(t);
+    auto const events = t.compute_events();
+    auto const mid = events.size() / 2;
+    return ct::benchmark([&] { return ct::slice(t, index, events[mid].cycles, events[mid + 1000].cycles).empty(); });
+}
+
+CT_BENCHMARK(compute_location_stats_64k)
+{
+    auto const t = make_trace(1 << 13);
+    return ct::benchmark([&] { return t.compute_location_stats().size(); });
+}
+
+CT_BENCHMARK(export_speedscope_json_64k)
+{
+    auto const t = make_trace(1 << 13);
+    return benchmark_export([&] { ct::write_speedscope_json(t, export_file); });
+}
+
+CT_BENCHMARK(export_chrome_tracing_json_64k)
+{
+    auto const t = make_trace(1 << 13);
+    return benchmark_export([&] { ct::write_chrome_tracing_json(t, export_file); });
+}
+
+CT_BENCHMARK(export_summary_csv_64k)
+{
+    auto const t = make_trace(1 << 13);
+    return benchmark_export([&] { ct::write_summary_csv(t, export_file); });
+}
+
+CT_BENCHMARK(export_diff_csv_64k)
+{
+    auto const d = ct::diff(make_trace(1 << 13), make_trace(1 << 13));
+    return benchmark_export([&] { ct::write_diff_csv(d, export_file); });
+}
+
+CT_BENCHMARK(export_diff_folded_64k)
+{
+    auto const a = make_trace(1 << 13);
+    auto const b = make_trace(1 << 13);
+    return benchmark_export([&] { ct::write_diff_folded(a, b, export_file); });
+}
+
+// =============== contention ===============
+
+namespace
+{
+void run_scaling()
+{
+    cc::vector<int> thread_counts;
+    for (auto n = 1; n <= ct::hardware_thread_count(); n *= 2)
+        thread_counts.push_back(n);
+    if (thread_counts.back() != ct::hardware_thread_count())
+        thread_counts.push_back(ct::hardware_thread_count());
+
+    // TRACE itself is thread-local, threads only share the (mutex protected) chunk allocator
+    auto const run = [&](char const* name, std::shared_ptr<ct::ChunkAllocator> const& allocator)
+    {
+        std::cout << name << ":" << std::endl;
+        ct::benchmark_parallel(
+            [&]
+            {
+                ct::scope s("", allocator);
+                for (auto i = 0; i < 64; ++i)
+                {
+                    TRACE();
+                }
+            },
+            thread_counts)
+            .print_summary("  ");
+    };
+
+    run("trace_x64_scope (64k chunks)", default_allocator());
+    run("trace_x64_scope (128 dword chunks, shared allocator)", small_allocator());
+}
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 2 && std::string(argv[1]) == "--scaling")
+    {
+        run_scaling();
+        return 0;
+    }
+
+    return ct::benchmark_main(argc, argv);
+}
@@ -4,14 +4,20 @@
 #include <cassert>
 
 #include "chunk.hh"
+#include "detail.hh"
 #include "trace-config.hh"
 
 static std::atomic<size_t> _total_memory = 0;
+static std::atomic<size_t> _memory_budget = 0; // 0 = unlimited
 
 using namespace ct;
 
 size_t ct::get_total_memory_consumption() { return _total_memory.load(); }
 
+void ct::detail::set_chunk_memory_budget(size_t bytes) { _memory_budget.store(bytes); }
+
+void ct::detail::add_tracked_memory(int64_t bytes) { _total_memory.fetch_add(size_t(bytes)); }
+
 void chunk::allocate(std::shared_ptr<ChunkAllocator> const& allocator)
 {
     assert(!is_allocated() && "cannot allocate an already allocated chunk");
@@ -23,7 +29,7 @@ void chunk::allocate(std::shared_ptr<ChunkAllocator> const& allocator)
     _allocator = allocator->shared_from_this();
 }
 
-uint32_t* ChunkAllocator::alloc_data()
+uint32_t* ChunkAllocator::alloc_data(bool within_budget)
 {
     {
         std::scoped_lock l(mutex);
@@ -35,7 +41,21 @@ uint32_t* ChunkAllocator::alloc_data()
         }
     }
 
-    _total_memory.fetch_add(chunk_size * sizeof(uint32_t));
+    auto const bytes = chunk_size * sizeof(uint32_t);
+    if (within_budget)
+    {
+        // reserve the bytes first so concurrent allocations cannot overshoot the budget
+        auto const budget = _memory_budget.load();
+        auto total = _total_memory.load();
+        do
+        {
+            if (budget > 0 && total + bytes > budget)
+                return nullptr;
+        } while (!_total_memory.compare_exchange_weak(total, total + bytes));
+    }
+    else
+        _total_memory.fetch_add(bytes);
+
     return new uint32_t[chunk_size];
 }
 
@@ -68,6 +88,12 @@ std::shared_ptr<ChunkAllocator> ChunkAllocator::global()
     return a;
 }
 
+ChunkAllocator::~ChunkAllocator()
+{
+    // pooled chunks are freed with the allocator
+    _total_memory.fetch_sub(free_list.size() * chunk_size * sizeof(uint32_t));
+}
+
 chunk ChunkAllocator::allocate()
 {
     chunk c;
@@ -75,6 +101,18 @@ chunk ChunkAllocator::allocate()
     return c;
 }
 
+chunk ChunkAllocator::try_allocate()
+{
+    chunk c;
+    c._data = alloc_data(true);
+    if (c._data)
+    {
+        c._capacity = chunk_size;
+        c._allocator = shared_from_this();
+    }
+    return c;
+}
+
 void ChunkAllocator::free(uint32_t data[])
 {
     mutex.lock();
@@ -21,13 +21,18 @@ public:
     static std::shared_ptr<ChunkAllocator> global();
 
     chunk allocate();
+    /// same as allocate() but returns an unallocated chunk if new memory would exceed the global memory budget
+    /// (chunks from the free list are always returned)
+    chunk try_allocate();
+
+    ~ChunkAllocator();
 
 
 private:
     ChunkAllocator(size_t chunk_size) : chunk_size(chunk_size) {}
 
     void free(uint32_t data[]);
-    uint32_t* alloc_data();
+    uint32_t* alloc_data(bool within_budget = false);
 
     // ref type
     ChunkAllocator(ChunkAllocator const&) = delete;
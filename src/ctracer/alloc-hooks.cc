@@ -0,0 +1,70 @@
+#include "alloc-hooks.hh"
+
+#include <atomic>
+#include <cstdlib>
+
+using namespace ct;
+
+namespace
+{
+// trivial type, so no dynamic initialization (which could allocate) is needed
+thread_local alloc_counters _counters;
+
+std::atomic<bool> _hooks_enabled = false;
+
+// every hooked allocation is prefixed by a header (directly before the returned pointer)
+struct header
+{
+    void* raw;
+    std::size_t size;
+};
+static_assert(sizeof(header) == 16, "header must keep 16 byte alignment");
+}
+
+alloc_counters ct::get_thread_alloc_counters() { return _counters; }
+
+bool ct::allocation_hooks_enabled() { return _hooks_enabled.load(std::memory_order_relaxed); }
+
+void* detail::hooked_alloc(std::size_t size, std::size_t alignment, bool throw_on_failure)
+{
+    if (alignment < sizeof(header))
+        alignment = sizeof(header);
+
+    auto const raw = std::malloc(size + sizeof(header) + alignment - 1);
+    if (!raw)
+    {
+        if (throw_on_failure)
+            throw std::bad_alloc();
+        return nullptr;
+    }
+
+    auto const p = (reinterpret_cast<std::uintptr_t>(raw) + sizeof(header) + alignment - 1) / alignment * alignment;
+    auto const h = reinterpret_cast<header*>(p) - 1;
+    h->raw = raw;
+    h->size = size;
+
+    auto& c = _counters;
+    c.allocations++;
+    c.allocated_bytes += size;
+    if (c.allocated_bytes - c.freed_bytes > c.peak_bytes && c.allocated_bytes > c.freed_bytes)
+        c.peak_bytes = c.allocated_bytes - c.freed_bytes;
+
+    if (!_hooks_enabled.load(std::memory_order_relaxed))
+        _hooks_enabled.store(true, std::memory_order_relaxed);
+
+    return reinterpret_cast<void*>(p);
+}
+
+void detail::hooked_free(void* p) noexcept
+{
+    if (!p)
+        return;
+
+    auto const h = static_cast<header*>(p) - 1;
+
+    auto& c = _counters;
+    c.deallocations++;
+    c.freed_bytes += h->size;
+
+    std::free(h->raw);
+}
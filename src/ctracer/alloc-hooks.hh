@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+/*
+ * Opt-in allocation counting
+ *
+ * Put CT_DEFINE_ALLOCATION_HOOKS() into exactly one .cc file of the final executable (global namespace).
+ * This replaces the global operator new/delete by versions that count allocations and bytes per thread.
+ *
+ * Usage:
+ *   CT_DEFINE_ALLOCATION_HOOKS()
+ *
+ *   auto before = ct::get_thread_alloc_counters();
+ *   do_stuff();
+ *   auto allocs = ct::get_thread_alloc_counters().allocations - before.allocations;
+ *
+ * Counters are also reported by ct::benchmark (per sample) and ct::scope (during its lifetime).
+ *
+ * NOTE: only operator new/delete are hooked, direct malloc/free calls are not counted
+ * NOTE: memory freed by a different thread than the allocating one is counted in the freeing thread
+ */
+
+#define CT_DEFINE_ALLOCATION_HOOKS()                                                                                                  \
+    void* operator new(std::size_t size) { return ct::detail::hooked_alloc(size, 0, true); }                                          \
+    void* operator new[](std::size_t size) { return ct::detail::hooked_alloc(size, 0, true); }                                        \
+    void* operator new(std::size_t size, std::nothrow_t const&) noexcept { return ct::detail::hooked_alloc(size, 0, false); }        \
+    void* operator new[](std::size_t size, std::nothrow_t const&) noexcept { return ct::detail::hooked_alloc(size, 0, false); }      \
+    void* operator new(std::size_t size, std::align_val_t a) { return ct::detail::hooked_alloc(size, std::size_t(a), true); }        \
+    void* operator new[](std::size_t size, std::align_val_t a) { return ct::detail::hooked_alloc(size, std::size_t(a), true); }      \
+    void* operator new(std::size_t size, std::align_val_t a, std::nothrow_t const&) noexcept                                         \
+    {                                                                                                                                \
+        return ct::detail::hooked_alloc(size, std::size_t(a), false);                                                                \
+    }                                                                                                                                \
+    void* operator new[](std::size_t size, std::align_val_t a, std::nothrow_t const&) noexcept                                       \
+    {                                                                                                                                \
+        return ct::detail::hooked_alloc(size, std::size_t(a), false);                                                                \
+    }                                                                                                                                \
+    void operator delete(void* p) noexcept { ct::detail::hooked_free(p); }                                                           \
+    void operator delete[](void* p) noexcept { ct::detail::hooked_free(p); }                                                         \
+    void operator delete(void* p, std::size_t) noexcept { ct::detail::hooked_free(p); }                                              \
+    void operator delete[](void* p, std::size_t) noexcept { ct::detail::hooked_free(p); }                                            \
+    void operator delete(void* p, std::nothrow_t const&) noexcept { ct::detail::hooked_free(p); }                                    \
+    void operator delete[](void* p, std::nothrow_t const&) noexcept { ct::detail::hooked_free(p); }                                  \
+    void operator delete(void* p, std::align_val_t) noexcept { ct::detail::hooked_free(p); }                                         \
+    void operator delete[](void* p, std::align_val_t) noexcept { ct::detail::hooked_free(p); }                                       \
+    void operator delete(void* p, std::size_t, std::align_val_t) noexcept { ct::detail::hooked_free(p); }                            \
+    void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { ct::detail::hooked_free(p); }                          \
+    void operator delete(void* p, std::align_val_t, std::nothrow_t const&) noexcept { ct::detail::hooked_free(p); }                  \
+    void operator delete[](void* p, std::align_val_t, std::nothrow_t const&) noexcept { ct::detail::hooked_free(p); }                \
+    static_assert(true, "")
+
+namespace ct
+{
+/// heap allocation counters of a single thread
+struct alloc_counters
+{
+    uint64_t allocations = 0;
+    uint64_t deallocations = 0;
+    uint64_t allocated_bytes = 0;
+    uint64_t freed_bytes = 0;
+    uint64_t peak_bytes = 0; ///< maximum of allocated_bytes - freed_bytes
+
+    int64_t live_bytes() const { return int64_t(allocated_bytes) - int64_t(freed_bytes); }
+};
+
+/// returns the counters of the calling thread (all zero if the hooks are not enabled)
+alloc_counters get_thread_alloc_counters();
+
+/// true if CT_DEFINE_ALLOCATION_HOOKS() is used and at least one allocation happened
+bool allocation_hooks_enabled();
+
+namespace detail
+{
+void* hooked_alloc(std::size_t size, std::size_t alignment, bool throw_on_failure);
+void hooked_free(void* p) noexcept;
+}
+}
@@ -0,0 +1,97 @@
+#include "benchmark-suite.hh"
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include "statistics.hh"
+
+using namespace ct;
+
+namespace
+{
+cc::vector<double> per_sample_cycles(benchmark_results const& r)
+{
+    cc::vector<double> values;
+    for (auto const& t : r.experiments)
+        values.push_back(double(t.cycles) / t.samples - r.cycles_estimate.baseline);
+    return values;
+}
+
+named_benchmark_results const* find_by_name(cc::vector<named_benchmark_results> const& results, cc::string const& name)
+{
+    for (auto const& r : results)
+        if (r.name == name)
+            return &r;
+    return nullptr;
+}
+}
+
+int ct::compare_benchmarks(cc::vector<named_benchmark_results> const& old_results,
+                           cc::vector<named_benchmark_results> const& new_results,
+                           benchmark_compare_config const& cfg)
+{
+    auto const red = cfg.color ? "\033[31m" : "";
+    auto const green = cfg.color ? "\033[32m" : "";
+    auto const reset = cfg.color ? "\033[0m" : "";
+
+    // an empty side means a missing or unreadable file, which must not pass as "no regressions"
+    if (old_results.empty() || new_results.empty())
+    {
+        std::cerr << "[ctracer] no " << (old_results.empty() ? "baseline" : "new") << " benchmark results, nothing was compared" << std::endl;
+        return 2;
+    }
+
+    auto regressions = 0;
+
+    std::printf("%-40s %14s %14s %9s %9s  %s\n", "benchmark", "old [cc]", "new [cc]", "change", "p", "status");
+
+    for (auto const& n : new_results)
+    {
+        auto const o = find_by_name(old_results, n.name);
+        if (!o)
+        {
+            std::printf("%-40s %14s %14.2f %9s %9s  added\n", n.name.c_str(), "-", n.results.cycles_estimate.median, "", "");
+            continue;
+        }
+
+        auto const old_median = o->results.cycles_estimate.median;
+        auto const new_median = n.results.cycles_estimate.median;
+        auto const change = old_median > 0 ? new_median / old_median - 1 : 0.0;
+        auto const p = mann_whitney_u_p_value(per_sample_cycles(o->results), per_sample_cycles(n.results));
+        auto const significant = p < cfg.alpha;
+
+        auto color = "";
+        auto status = "~";
+        if (significant && change > cfg.regression_threshold)
+        {
+            color = red;
+            status = "REGRESSION";
+            ++regressions;
+        }
+        else if (significant && change < -cfg.regression_threshold)
+        {
+            color = green;
+            status = "faster";
+        }
+        else if (significant)
+            status = "changed (within threshold)";
+
+        std::printf("%s%-40s %14.2f %14.2f %+8.1f%% %9.2g  %s%s\n", color, n.name.c_str(), old_median, new_median, change * 100, p, status, reset);
+    }
+
+    for (auto const& o : old_results)
+        if (!find_by_name(new_results, o.name))
+            std::printf("%-40s %14.2f %14s %9s %9s  removed\n", o.name.c_str(), o.results.cycles_estimate.median, "-", "", "");
+
+    if (regressions > 0)
+        std::printf("%s%d benchmark(s) regressed by more than %.1f%%%s\n", red, regressions, cfg.regression_threshold * 100, reset);
+
+    return regressions > 0 ? 1 : 0;
+}
+
+int ct::compare_benchmarks(cc::string_view old_file, cc::string_view new_file, benchmark_compare_config const& cfg)
+{
+    return compare_benchmarks(read_benchmark_results(old_file), read_benchmark_results(new_file), cfg);
+}
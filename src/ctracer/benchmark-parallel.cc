@@ -0,0 +1,139 @@
+#include "benchmark-parallel.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "system.hh"
+#include "trace.hh"
+
+using namespace ct;
+
+namespace
+{
+using wall_clock = std::chrono::steady_clock;
+
+struct worker_result
+{
+    parallel_benchmark_results::thread_timing timing;
+    wall_clock::time_point start;
+    wall_clock::time_point end;
+};
+}
+
+parallel_benchmark_results detail::run_parallel_benchmark(parallel_benchmark_config const& cfg, cc::vector<int> const& thread_counts, batch_fun batch)
+{
+    auto constexpr min_batch_cycles = 20'000; // stop flag is checked between batches
+
+    parallel_benchmark_results res;
+    auto const cores = hardware_thread_count();
+
+    for (auto n : thread_counts)
+    {
+        if (n < 1)
+            continue;
+
+        std::atomic<int> arrived = 0;
+        std::atomic<bool> go = false;
+        std::atomic<bool> stop = false;
+        std::vector<worker_result> results;
+        results.resize(size_t(n));
+        std::vector<std::thread> threads;
+
+        for (auto t = 0; t < n; ++t)
+            threads.emplace_back([&, t] {
+                auto& r = results[size_t(t)];
+                r.timing.thread = t;
+                if (cfg.pin_threads)
+                {
+                    auto const core = (cfg.first_core + t) % cores;
+                    if (pin_current_thread(core))
+                        r.timing.core = core;
+                }
+
+                // spin barrier
+                arrived.fetch_add(1);
+                while (!go.load(std::memory_order_acquire))
+                {
+                }
+
+                uint64_t count = 1;
+                uint64_t samples = 0;
+                r.start = wall_clock::now();
+                auto const c_start = ct::current_cycles();
+                while (!stop.load(std::memory_order_relaxed))
+                {
+                    auto const c_batch = ct::current_cycles();
+                    batch(t, count);
+                    samples += count;
+
+                    // grow batches until the stop check is negligible
+                    if (ct::current_cycles() - c_batch < min_batch_cycles)
+                        count *= 2;
+                }
+                auto const c_end = ct::current_cycles();
+                r.end = wall_clock::now();
+
+                r.timing.samples = samples;
+                r.timing.cycles = c_end - c_start;
+                r.timing.seconds = std::chrono::duration<double>(r.end - r.start).count();
+            });
+
+        while (arrived.load() < n)
+            std::this_thread::yield();
+        go.store(true, std::memory_order_release);
+        std::this_thread::sleep_for(std::chrono::duration<double>(cfg.seconds_per_point));
+        stop.store(true);
+
+        for (auto& t : threads)
+            t.join();
+
+        auto& p = res.points.emplace_back();
+        p.threads = n;
+        auto start = results[0].start;
+        auto end = results[0].end;
+        for (auto const& r : results)
+        {
+            p.per_thread.push_back(r.timing);
+            p.samples += r.timing.samples;
+            start = std::min(start, r.start);
+            end = std::max(end, r.end);
+        }
+        p.wall_seconds = std::chrono::duration<double>(end - start).count();
+        p.throughput = p.wall_seconds > 0 ? p.samples / p.wall_seconds : 0.0;
+    }
+
+    // efficiency relative to the single-thread point (or the smallest thread count)
+    if (!res.points.empty())
+    {
+        auto const* ref = &res.points[0];
+        for (auto const& p : res.points)
+            if (p.threads < ref->threads)
+                ref = &p;
+
+        auto const single_throughput = ref->throughput / ref->threads;
+        for (auto& p : res.points)
+            p.efficiency = single_throughput > 0 ? p.throughput / (p.threads * single_throughput) : 0.0;
+    }
+
+    return res;
+}
+
+void parallel_benchmark_results::print_summary(cc::string_view prefix) const
+{
+    auto const s_prefix = cc::string(prefix);
+    for (auto const& p : points)
+    {
+        auto cycles = 0.0;
+        for (auto const& t : p.per_thread)
+            cycles += t.cycles_per_sample();
+        cycles /= std::max<size_t>(1, p.per_thread.size());
+
+        std::cout << s_prefix.c_str() << p.threads << " thread(s): " << p.throughput << " samples / sec (" << p.throughput / p.threads
+                  << " per thread, " << cycles << " cycles / sample), efficiency " << std::round(p.efficiency * 1000) / 10 << "%" << std::endl;
+    }
+}
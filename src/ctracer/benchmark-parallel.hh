@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#include <clean-core/function_ref.hh>
+#include <clean-core/string.hh>
+#include <clean-core/vector.hh>
+
+#include "benchmark.hh"
+
+/*
+ * Multithreaded throughput and scaling benchmarks
+ *
+ * Usage:
+ *   auto res = ct::benchmark_parallel([&] { queue.push(1); queue.pop(); }, {1, 2, 4, 8});
+ *   res.print_summary();
+ *
+ *   // f can optionally take the thread index
+ *   ct::benchmark_parallel([&](int thread) { counters[thread]++; }, {1, 2, 4});
+ *
+ * For each thread count, N threads are started (and pinned to distinct cores),
+ * released at the same time via a spin barrier, and execute f until the time budget is over.
+ */
+
+namespace ct
+{
+struct parallel_benchmark_config
+{
+    /// duration of the measurement per thread count
+    double seconds_per_point = 0.5;
+    /// pins thread i to core (first_core + i) % hardware_thread_count()
+    bool pin_threads = true;
+    int first_core = 0;
+};
+
+struct parallel_benchmark_results
+{
+    struct thread_timing
+    {
+        int thread = 0;
+        int core = -1; ///< -1 if not pinned
+        uint64_t samples = 0;
+        uint64_t cycles = 0; ///< measured by ct::current_cycles() on the thread itself
+        double seconds = 0;
+
+        double throughput() const { return seconds > 0 ? samples / seconds : 0.0; }
+        double cycles_per_sample() const { return samples > 0 ? cycles / double(samples) : 0.0; }
+    };
+
+    struct point
+    {
+        int threads = 0;
+        cc::vector<thread_timing> per_thread;
+
+        double wall_seconds = 0; ///< from the first thread start to the last thread end
+        uint64_t samples = 0;    ///< sum over all threads
+        double throughput = 0;   ///< samples / wall_seconds
+        double efficiency = 0;   ///< throughput / (threads * single-thread throughput)
+    };
+
+    cc::vector<point> points;
+
+    void print_summary(cc::string_view prefix = "") const;
+};
+
+namespace detail
+{
+/// executes f "count" times on thread "thread"
+using batch_fun = cc::function_ref<void(int thread, uint64_t count)>;
+
+parallel_benchmark_results run_parallel_benchmark(parallel_benchmark_config const& cfg, cc::vector<int> const& thread_counts, batch_fun batch);
+}
+
+template <class F>
+parallel_benchmark_results benchmark_parallel(F&& f, cc::vector<int> const& thread_counts, parallel_benchmark_config const& cfg = {})
+{
+    static_assert(std::is_invocable_v<F> || std::is_invocable_v<F, int>, "f must be invocable with no arguments or the thread index");
+
+    return detail::run_parallel_benchmark(cfg, thread_counts, [&](int thread, uint64_t count) {
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            if constexpr (std::is_invocable_v<F, int>)
+            {
+                if constexpr (std::is_same_v<std::invoke_result_t<F, int>, void>)
+                    f(thread);
+                else
+                    sink << f(thread);
+            }
+            else
+            {
+                if constexpr (std::is_same_v<std::invoke_result_t<F>, void>)
+                    f();
+                else
+                    sink << f();
+            }
+        }
+    });
+}
+}
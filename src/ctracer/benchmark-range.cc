@@ -0,0 +1,87 @@
+#include "benchmark-range.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace ct;
+
+cc::vector<int64_t> ct::powers_of_two(int64_t min, int64_t max)
+{
+    cc::vector<int64_t> sizes;
+    int64_t s = 1;
+    while (s < min && s <= max / 2)
+        s *= 2;
+    for (; s >= min && s <= max; s *= 2)
+    {
+        sizes.push_back(s);
+        if (s > max / 2)
+            break;
+    }
+    return sizes;
+}
+
+benchmark_range_results detail::run_benchmark_range(benchmark_range_config const& cfg, cc::vector<int64_t> const& sizes, size_benchmark_fun run)
+{
+    benchmark_range_results res;
+
+    for (auto size : sizes)
+    {
+        auto& p = res.points.emplace_back();
+        p.size = size;
+        p.results = run(size);
+        p.cycles_per_sample = p.results.cycles_estimate.median;
+    }
+
+    cc::vector<double> n;
+    cc::vector<double> y;
+    for (auto const& p : res.points)
+    {
+        n.push_back(double(p.size));
+        y.push_back(p.cycles_per_sample);
+    }
+    res.fits = ct::fit_complexity(n, y);
+    if (res.fits.empty())
+        return res;
+
+    // knees: jumps in the cost normalized by the best fit
+    auto const fit = res.best_fit();
+    auto prev_cost = 0.0;
+    for (auto const& p : res.points)
+    {
+        auto const model = fit.coefficient * complexity_model(fit.model, double(p.size));
+        if (model <= 0 || p.cycles_per_sample <= 0)
+            continue;
+
+        auto const cost = p.cycles_per_sample / model;
+        if (prev_cost > 0 && cost / prev_cost >= cfg.knee_threshold)
+            res.knees.push_back({p.size, cost / prev_cost});
+        prev_cost = cost;
+    }
+
+    return res;
+}
+
+void benchmark_range_results::print_summary(cc::string_view prefix) const
+{
+    auto const s_prefix = cc::string(prefix);
+    for (auto const& p : points)
+        std::cout << s_prefix.c_str() << "n = " << p.size << ": " << p.cycles_per_sample << " cycles / sample (+-"
+                  << std::round(p.results.cycles_estimate.relative_ci() * 1000) / 10 << "%)" << std::endl;
+
+    if (fits.empty())
+    {
+        std::cout << s_prefix.c_str() << "no complexity fit possible" << std::endl;
+        return;
+    }
+
+    auto const fit = best_fit();
+    std::cout << s_prefix.c_str() << "best fit: " << to_string(fit.model) << " with " << fit.coefficient << " cycles (rms error "
+              << std::round(fit.rms_error * 1000) / 10 << "%)";
+    if (fits.size() > 1)
+        std::cout << ", next: " << to_string(fits[1].model) << " (rms error " << std::round(fits[1].rms_error * 1000) / 10 << "%)";
+    std::cout << std::endl;
+
+    for (auto const& k : knees)
+        std::cout << s_prefix.c_str() << "knee at n = " << k.size << ": cost per " << to_string(fit.model) << " unit x" << k.factor << std::endl;
+}
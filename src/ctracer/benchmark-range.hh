@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#include <clean-core/function_ref.hh>
+#include <clean-core/string.hh>
+#include <clean-core/vector.hh>
+
+#include "benchmark.hh"
+#include "statistics.hh"
+
+/*
+ * Parameter sweeps with asymptotic complexity fitting
+ *
+ * Usage:
+ *   // f(n) is benchmarked for every size
+ *   auto res = ct::benchmark_range([&](int64_t n) { return my_set.contains(n); }, ct::powers_of_two(1, 1 << 20));
+ *   res.print_summary(); // per-size timings, best fit (e.g. "O(log n)") and cache knees
+ *
+ *   // if f(n) returns a callable, f(n) prepares the data (not timed) and the callable is benchmarked
+ *   ct::benchmark_range([](int64_t n) {
+ *       auto v = make_random_vector(n);
+ *       return [v] { return std::accumulate(v.begin(), v.end(), 0); };
+ *   }, ct::powers_of_two(1 << 10, 1 << 26));
+ *
+ * Knees are sizes where the cost per element (relative to the best fit) jumps, typically when
+ * the working set stops fitting into a cache level.
+ */
+
+namespace ct
+{
+struct benchmark_range_config
+{
+    /// used for every size
+    benchmark_config benchmark;
+
+    /// minimum jump of the normalized cost between consecutive sizes to be reported as knee
+    double knee_threshold = 1.25;
+};
+
+struct benchmark_range_results
+{
+    struct point
+    {
+        int64_t size = 0;
+        double cycles_per_sample = 0; ///< baseline subtracted median
+        benchmark_results results;
+    };
+
+    struct knee
+    {
+        int64_t size = 0; ///< first size after the jump
+        double factor = 0; ///< jump of cycles_per_sample / (coefficient * g(size)) relative to the previous size
+    };
+
+    cc::vector<point> points;
+
+    /// all models, best first
+    cc::vector<complexity_fit> fits;
+
+    cc::vector<knee> knees;
+
+    /// best fitting model (O(1) with coefficient 0 if nothing could be fitted)
+    complexity_fit best_fit() const { return fits.empty() ? complexity_fit{} : fits[0]; }
+
+    void print_summary(cc::string_view prefix = "") const;
+};
+
+/// powers of two in [min, max] (min is rounded up to a power of two)
+cc::vector<int64_t> powers_of_two(int64_t min, int64_t max);
+
+namespace detail
+{
+using size_benchmark_fun = cc::function_ref<benchmark_results(int64_t size)>;
+
+benchmark_range_results run_benchmark_range(benchmark_range_config const& cfg, cc::vector<int64_t> const& sizes, size_benchmark_fun run);
+}
+
+template <class F>
+benchmark_range_results benchmark_range(benchmark_range_config const& cfg, F&& f, cc::vector<int64_t> const& sizes)
+{
+    static_assert(std::is_invocable_v<F, int64_t>, "f must be invocable with the size");
+
+    return detail::run_benchmark_range(cfg, sizes, [&](int64_t size) {
+        if constexpr (std::is_invocable_v<std::invoke_result_t<F, int64_t>>)
+        {
+            auto run = f(size);
+            return ct::benchmark(cfg.benchmark, run);
+        }
+        else
+            return ct::benchmark(cfg.benchmark, f, size);
+    });
+}
+
+template <class F>
+benchmark_range_results benchmark_range(F&& f, cc::vector<int64_t> const& sizes)
+{
+    return ct::benchmark_range(benchmark_range_config{}, f, sizes);
+}
+}
@@ -0,0 +1,544 @@
+#include "benchmark-suite.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace ct;
+
+namespace
+{
+// function-local static to be independent of static initialization order
+std::vector<registered_benchmark>& registry()
+{
+    static std::vector<registered_benchmark> r;
+    return r;
+}
+
+// returns false (and prints the error) if the filter is not a valid regex
+bool make_filter(cc::string const& pattern, std::regex& filter)
+{
+    try
+    {
+        filter = std::regex(pattern.c_str(), std::regex::ECMAScript);
+        return true;
+    }
+    catch (std::regex_error const& e)
+    {
+        std::cerr << "[ctracer] invalid benchmark filter '" << pattern.c_str() << "': " << e.what() << std::endl;
+        return false;
+    }
+}
+
+void write_json_string(std::ostream& out, char const* s)
+{
+    out << '"';
+    for (; *s; ++s)
+    {
+        switch (*s)
+        {
+        case '"':
+            out << "\\\"";
+            break;
+        case '\\':
+            out << "\\\\";
+            break;
+        case '\n':
+            out << "\\n";
+            break;
+        default:
+            out << *s;
+        }
+    }
+    out << '"';
+}
+
+void write_json_timings(std::ostream& out, cc::vector<benchmark_results::timing> const& timings)
+{
+    out << "[";
+    for (size_t i = 0; i < timings.size(); ++i)
+    {
+        auto const& t = timings[i];
+        if (i > 0)
+            out << ",";
+        out << "{\"samples\":" << t.samples << ",\"cycles\":" << t.cycles << ",\"seconds\":" << t.seconds;
+        if (t.migrated)
+            out << ",\"migrated\":1";
+        if (t.allocations > 0)
+            out << ",\"allocations\":" << t.allocations << ",\"allocated_bytes\":" << t.allocated_bytes;
+        if (t.has_counters)
+        {
+            auto const& c = t.counters;
+            out << ",\"counters\":{\"instructions\":" << c.instructions << ",\"cpu_cycles\":" << c.cpu_cycles << ",\"l1d_misses\":" << c.l1d_misses
+                << ",\"llc_misses\":" << c.llc_misses << ",\"branch_misses\":" << c.branch_misses << "}";
+        }
+        out << "}";
+    }
+    out << "]";
+}
+
+// minimal json reader, sufficient for files written by write_benchmark_json
+struct json_value
+{
+    enum class kind
+    {
+        null,
+        number,
+        string,
+        array,
+        object,
+    };
+
+    kind k = kind::null;
+    double number = 0;
+    std::string string;
+    std::vector<json_value> elements;
+    std::vector<std::pair<std::string, json_value>> members;
+
+    json_value const* get(char const* key) const
+    {
+        for (auto const& m : members)
+            if (m.first == key)
+                return &m.second;
+        return nullptr;
+    }
+};
+
+struct json_parser
+{
+    std::string const& s;
+    size_t pos = 0;
+    bool error = false;
+
+    void skip_ws()
+    {
+        while (pos < s.size() && std::isspace((unsigned char)s[pos]))
+            ++pos;
+    }
+
+    bool consume(char c)
+    {
+        skip_ws();
+        if (pos < s.size() && s[pos] == c)
+        {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    std::string parse_string()
+    {
+        std::string r;
+        if (!consume('"'))
+        {
+            error = true;
+            return r;
+        }
+        while (pos < s.size() && s[pos] != '"')
+        {
+            if (s[pos] == '\\' && pos + 1 < s.size())
+            {
+                ++pos;
+                r += s[pos] == 'n' ? '\n' : s[pos];
+            }
+            else
+                r += s[pos];
+            ++pos;
+        }
+        ++pos; // closing "
+        return r;
+    }
+
+    json_value parse()
+    {
+        json_value v;
+        skip_ws();
+        if (pos >= s.size())
+        {
+            error = true;
+            return v;
+        }
+
+        auto const c = s[pos];
+        if (c == '{')
+        {
+            v.k = json_value::kind::object;
+            ++pos;
+            if (consume('}'))
+                return v;
+            do
+            {
+                auto key = parse_string();
+                if (!consume(':'))
+                    error = true;
+                v.members.emplace_back(std::move(key), parse());
+            } while (!error && consume(','));
+            if (!consume('}'))
+                error = true;
+        }
+        else if (c == '[')
+        {
+            v.k = json_value::kind::array;
+            ++pos;
+            if (consume(']'))
+                return v;
+            do
+                v.elements.push_back(parse());
+            while (!error && consume(','));
+            if (!consume(']'))
+                error = true;
+        }
+        else if (c == '"')
+        {
+            v.k = json_value::kind::string;
+            v.string = parse_string();
+        }
+        else if (s.compare(pos, 4, "null") == 0)
+            pos += 4;
+        else
+        {
+            v.k = json_value::kind::number;
+            char* end = nullptr;
+            v.number = std::strtod(s.c_str() + pos, &end);
+            if (end == s.c_str() + pos)
+                error = true;
+            pos = size_t(end - s.c_str());
+        }
+
+        return v;
+    }
+};
+
+void read_json_timings(json_value const* v, cc::vector<benchmark_results::timing>& timings)
+{
+    if (!v)
+        return;
+
+    for (auto const& e : v->elements)
+    {
+        benchmark_results::timing t;
+        if (auto n = e.get("samples"))
+            t.samples = int(n->number);
+        if (auto n = e.get("cycles"))
+            t.cycles = uint64_t(n->number);
+        if (auto n = e.get("seconds"))
+            t.seconds = n->number;
+        if (auto n = e.get("migrated"))
+            t.migrated = n->number != 0;
+        if (auto n = e.get("allocations"))
+            t.allocations = uint64_t(n->number);
+        if (auto n = e.get("allocated_bytes"))
+            t.allocated_bytes = uint64_t(n->number);
+        if (auto c = e.get("counters"))
+        {
+            auto const get = [&](char const* name) -> uint64_t { return c->get(name) ? uint64_t(c->get(name)->number) : 0; };
+            t.has_counters = true;
+            t.counters.instructions = get("instructions");
+            t.counters.cpu_cycles = get("cpu_cycles");
+            t.counters.l1d_misses = get("l1d_misses");
+            t.counters.llc_misses = get("llc_misses");
+            t.counters.branch_misses = get("branch_misses");
+        }
+        timings.push_back(t);
+    }
+}
+
+void write_json_estimate(std::ostream& out, benchmark_results::estimate const& e)
+{
+    out << "{\"median\":" << e.median << ",\"ci_low\":" << e.ci_low << ",\"ci_high\":" << e.ci_high << ",\"mad\":" << e.mad
+        << ",\"baseline\":" << e.baseline << ",\"runs\":" << e.runs << ",\"outliers\":" << e.outliers << "}";
+}
+}
+
+detail::benchmark_registrar::benchmark_registrar(char const* name, char const* file, int line, benchmark_results (*fun)())
+{
+    registered_benchmark b;
+    b.name = name;
+    b.file = file;
+    b.line = line;
+    b.fun = fun;
+    registry().push_back(b);
+}
+
+cc::vector<registered_benchmark> ct::get_registered_benchmarks()
+{
+    auto benchmarks = registry(); // copy
+    std::stable_sort(benchmarks.begin(), benchmarks.end(),
+                     [](registered_benchmark const& a, registered_benchmark const& b) { return std::strcmp(a.name.c_str(), b.name.c_str()) < 0; });
+
+    cc::vector<registered_benchmark> res;
+    for (auto const& b : benchmarks)
+        res.push_back(b);
+    return res;
+}
+
+cc::vector<named_benchmark_results> ct::run_benchmarks(benchmark_suite_config const& cfg)
+{
+    cc::vector<named_benchmark_results> results;
+
+    std::regex filter;
+    if (!make_filter(cfg.filter, filter))
+        return results;
+    for (auto const& b : get_registered_benchmarks())
+    {
+        if (!std::regex_search(b.name.c_str(), filter))
+            continue;
+
+        auto& r = results.emplace_back();
+        r.name = b.name;
+        r.results = b.fun();
+
+        if (cfg.print)
+        {
+            auto prefix = b.name;
+            prefix += ": ";
+            r.results.print_summary(prefix);
+        }
+    }
+
+    if (!cfg.output_file.empty())
+    {
+        if (cfg.output_file.ends_with(".csv"))
+            write_benchmark_csv(results, cfg.output_file);
+        else
+            write_benchmark_json(results, cfg.output_file);
+    }
+
+    return results;
+}
+
+void ct::write_benchmark_json(cc::vector<named_benchmark_results> const& results, cc::string_view filename)
+{
+    std::ofstream out(cc::string(filename).c_str());
+    if (!out.good())
+    {
+        std::cerr << "[ctracer] could not open " << cc::string(filename).c_str() << " for writing" << std::endl;
+        return;
+    }
+
+    out.precision(17);
+
+    out << "{\"benchmarks\":[\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        auto const& r = results[i];
+        if (i > 0)
+            out << ",\n";
+
+        out << "{\"name\":";
+        write_json_string(out, r.name.c_str());
+        out << ",\"cycles_estimate\":";
+        write_json_estimate(out, r.results.cycles_estimate);
+        out << ",\"seconds_estimate\":";
+        write_json_estimate(out, r.results.seconds_estimate);
+        if (r.results.environment.controlled)
+        {
+            auto const& e = r.results.environment;
+            out << ",\"environment\":{\"core\":" << e.core << ",\"governor\":";
+            write_json_string(out, e.governor.c_str());
+            out << ",\"frequency_mhz\":" << e.frequency_mhz << ",\"load_average\":" << e.load_average
+                << ",\"tsc_cycles_per_second\":" << e.tsc_cycles_per_second << ",\"warmup_seconds\":" << e.warmup_seconds
+                << ",\"frequency_stable\":" << (e.frequency_stable ? 1 : 0) << ",\"discarded_runs\":" << e.discarded_runs << "}";
+        }
+        out << ",\"experiments\":";
+        write_json_timings(out, r.results.experiments);
+        out << ",\"warmups\":";
+        write_json_timings(out, r.results.warmups);
+        out << ",\"baselines\":";
+        write_json_timings(out, r.results.baselines);
+        if (r.results.has_cold())
+        {
+            out << ",\"cold_cycles_estimate\":";
+            write_json_estimate(out, r.results.cold_cycles_estimate);
+            out << ",\"cold_seconds_estimate\":";
+            write_json_estimate(out, r.results.cold_seconds_estimate);
+            out << ",\"cold_experiments\":";
+            write_json_timings(out, r.results.cold_experiments);
+            out << ",\"cold_baselines\":";
+            write_json_timings(out, r.results.cold_baselines);
+        }
+        out << "}";
+    }
+    out << "\n]}\n";
+}
+
+void ct::write_benchmark_csv(cc::vector<named_benchmark_results> const& results, cc::string_view filename)
+{
+    std::ofstream out(cc::string(filename).c_str());
+    if (!out.good())
+    {
+        std::cerr << "[ctracer] could not open " << cc::string(filename).c_str() << " for writing" << std::endl;
+        return;
+    }
+
+    out.precision(17);
+
+    out << "name,kind,samples,cycles,seconds\n";
+    for (auto const& r : results)
+    {
+        auto const write = [&](char const* kind, cc::vector<benchmark_results::timing> const& timings)
+        {
+            for (auto const& t : timings)
+                out << '"' << r.name.c_str() << '"' << "," << kind << "," << t.samples << "," << t.cycles << "," << t.seconds << "\n";
+        };
+        write("experiment", r.results.experiments);
+        write("warmup", r.results.warmups);
+        write("baseline", r.results.baselines);
+        write("cold_experiment", r.results.cold_experiments);
+        write("cold_baseline", r.results.cold_baselines);
+    }
+}
+
+cc::vector<named_benchmark_results> ct::read_benchmark_results(cc::string_view filename)
+{
+    cc::vector<named_benchmark_results> results;
+
+    std::ifstream in(cc::string(filename).c_str());
+    if (!in.good())
+    {
+        std::cerr << "[ctracer] could not open " << cc::string(filename).c_str() << " for reading" << std::endl;
+        return results;
+    }
+
+    if (cc::string(filename).ends_with(".csv"))
+    {
+        std::string line;
+        std::getline(in, line); // header
+        auto line_nr = 1;
+        while (std::getline(in, line))
+        {
+            ++line_nr;
+
+            // "name",kind,samples,cycles,seconds
+            auto const name_end = line.rfind('"');
+            if (line.empty() || line[0] != '"' || name_end == 0 || name_end == std::string::npos || name_end + 2 > line.size())
+            {
+                if (!line.empty())
+                    std::cerr << "[ctracer] skipping malformed line " << line_nr << " of " << cc::string(filename).c_str() << std::endl;
+                continue;
+            }
+            auto const name = line.substr(1, name_end - 1);
+
+            std::stringstream ss(line.substr(name_end + 2));
+            std::string kind, samples, cycles, seconds;
+            std::getline(ss, kind, ',');
+            std::getline(ss, samples, ',');
+            std::getline(ss, cycles, ',');
+            std::getline(ss, seconds, ',');
+
+            benchmark_results::timing t;
+            try
+            {
+                t.samples = std::stoi(samples);
+                t.cycles = std::stoull(cycles);
+                t.seconds = std::stod(seconds);
+            }
+            catch (std::exception const&) // std::invalid_argument or std::out_of_range, e.g. a truncated file
+            {
+                std::cerr << "[ctracer] skipping malformed line " << line_nr << " of " << cc::string(filename).c_str() << std::endl;
+                continue;
+            }
+
+            if (results.empty() || results.back().name != name.c_str())
+                results.emplace_back().name = name.c_str();
+
+            auto& r = results.back().results;
+            if (kind == "experiment")
+                r.experiments.push_back(t);
+            else if (kind == "warmup")
+                r.warmups.push_back(t);
+            else if (kind == "baseline")
+                r.baselines.push_back(t);
+            else if (kind == "cold_experiment")
+                r.cold_experiments.push_back(t);
+            else if (kind == "cold_baseline")
+                r.cold_baselines.push_back(t);
+        }
+    }
+    else
+    {
+        auto const content = std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        json_parser p{content};
+        auto const root = p.parse();
+        auto const benchmarks = root.get("benchmarks");
+        if (p.error || !benchmarks)
+        {
+            std::cerr << "[ctracer] could not parse " << cc::string(filename).c_str() << std::endl;
+            return results;
+        }
+
+        for (auto const& b : benchmarks->elements)
+        {
+            auto& r = results.emplace_back();
+            if (auto n = b.get("name"))
+                r.name = n->string.c_str();
+            read_json_timings(b.get("experiments"), r.results.experiments);
+            read_json_timings(b.get("warmups"), r.results.warmups);
+            read_json_timings(b.get("baselines"), r.results.baselines);
+            read_json_timings(b.get("cold_experiments"), r.results.cold_experiments);
+            read_json_timings(b.get("cold_baselines"), r.results.cold_baselines);
+        }
+    }
+
+    for (auto& r : results)
+        r.results.compute_estimates();
+
+    return results;
+}
+
+int ct::benchmark_main(int argc, char** argv)
+{
+    benchmark_suite_config cfg;
+    auto list_only = false;
+    std::string baseline_file;
+
+    auto const print_usage = [&]
+    {
+        std::cerr << "usage: " << argv[0] << " [--filter <regex>] [--out <file.json|file.csv>] [--list] [--baseline <file>]" << std::endl;
+        return 1;
+    };
+
+    for (auto i = 1; i < argc; ++i)
+    {
+        auto const arg = std::string(argv[i]);
+        if (arg == "--filter" && i + 1 < argc)
+            cfg.filter = argv[++i];
+        else if (arg == "--out" && i + 1 < argc)
+            cfg.output_file = argv[++i];
+        else if (arg == "--list")
+            list_only = true;
+        else if (arg == "--baseline" && i + 1 < argc)
+            baseline_file = argv[++i];
+        else
+            return print_usage();
+    }
+
+    std::regex filter;
+    if (!make_filter(cfg.filter, filter))
+        return print_usage();
+
+    if (list_only)
+    {
+        for (auto const& b : get_registered_benchmarks())
+            if (std::regex_search(b.name.c_str(), filter))
+                std::cout << b.name.c_str() << std::endl;
+        return 0;
+    }
+
+    auto const results = run_benchmarks(cfg);
+
+    if (!baseline_file.empty())
+        return compare_benchmarks(read_benchmark_results(baseline_file.c_str()), results);
+
+    return 0;
+}
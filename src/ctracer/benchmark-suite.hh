@@ -0,0 +1,106 @@
+#pragma once
+
+#include <clean-core/macros.hh>
+#include <clean-core/string.hh>
+#include <clean-core/vector.hh>
+
+#include "benchmark.hh"
+
+/*
+ * Benchmark registry and suite runner
+ *
+ * Usage:
+ *   CT_BENCHMARK(vector_push_back)
+ *   {
+ *       return ct::benchmark([] { ... });
+ *   }
+ *
+ *   int main(int argc, char** argv) { return ct::benchmark_main(argc, argv); }
+ *
+ * Command line of benchmark_main:
+ *   --filter <regex>   only run benchmarks whose name matches (std::regex_search)
+ *   --out <file>       writes all results to a .json or .csv file
+ *   --list             only prints the names of matching benchmarks
+ *   --baseline <file>  compares the results against a previous result file (exit code 1 on regression, 2 if nothing was compared)
+ *
+ * Comparing result files (e.g. in CI):
+ *   auto status = ct::compare_benchmarks("old.json", "new.json");
+ */
+
+#define CT_BENCHMARK(name)                                                                                                       \
+    static ct::benchmark_results CC_MACRO_JOIN(_ct_benchmark_fun_, name)();                                                      \
+    static ct::detail::benchmark_registrar CC_MACRO_JOIN(_ct_benchmark_reg_, name)(#name, __FILE__, __LINE__,                    \
+                                                                                    &CC_MACRO_JOIN(_ct_benchmark_fun_, name)); \
+    static ct::benchmark_results CC_MACRO_JOIN(_ct_benchmark_fun_, name)()
+
+namespace ct
+{
+struct registered_benchmark
+{
+    cc::string name;
+    char const* file = nullptr;
+    int line = 0;
+    benchmark_results (*fun)() = nullptr;
+};
+
+struct named_benchmark_results
+{
+    cc::string name;
+    benchmark_results results;
+};
+
+struct benchmark_suite_config
+{
+    /// ECMAScript regex, only matching benchmarks are run (empty runs all)
+    cc::string filter;
+    /// if not empty, results are written to this file (format is chosen by extension: .json or .csv)
+    cc::string output_file;
+    /// prints a summary line per benchmark
+    bool print = true;
+};
+
+struct benchmark_compare_config
+{
+    /// relative slowdown of the median above which a significant change counts as regression
+    double regression_threshold = 0.05;
+    /// significance level of the Mann-Whitney U test on the per-sample cycles of the experiments
+    double alpha = 0.01;
+    /// use ANSI colors in the printed table
+    bool color = true;
+};
+
+/// all registered benchmarks, sorted by name
+cc::vector<registered_benchmark> get_registered_benchmarks();
+
+/// runs all registered benchmarks matching the filter in stable (name) order
+/// NOTE: returns no results (and prints an error) if the filter is not a valid regex
+cc::vector<named_benchmark_results> run_benchmarks(benchmark_suite_config const& cfg = {});
+
+/// writes estimates and raw timings (experiments, warmups, baselines) of all results
+void write_benchmark_json(cc::vector<named_benchmark_results> const& results, cc::string_view filename);
+/// writes one row per raw timing ("name,kind,samples,cycles,seconds")
+void write_benchmark_csv(cc::vector<named_benchmark_results> const& results, cc::string_view filename);
+
+/// reads results written by write_benchmark_json or write_benchmark_csv (format is chosen by extension)
+/// NOTE: estimates are recomputed from the raw timings, malformed CSV lines are skipped (with a warning)
+cc::vector<named_benchmark_results> read_benchmark_results(cc::string_view filename);
+
+/// matches benchmarks by name, prints a speedup/slowdown table, and
+/// returns 1 if any benchmark regressed by more than the configured threshold,
+/// 2 if either side has no results (e.g. a missing or unreadable file), otherwise 0
+int compare_benchmarks(cc::vector<named_benchmark_results> const& old_results,
+                       cc::vector<named_benchmark_results> const& new_results,
+                       benchmark_compare_config const& cfg = {});
+int compare_benchmarks(cc::string_view old_file, cc::string_view new_file, benchmark_compare_config const& cfg = {});
+
+/// command line entry point, returns the process exit code
+int benchmark_main(int argc, char** argv);
+
+namespace detail
+{
+struct benchmark_registrar
+{
+    benchmark_registrar(char const* name, char const* file, int line, benchmark_results (*fun)());
+};
+}
+}
@@ -2,11 +2,16 @@
 
 // TODO: remove me in some future cleanup
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
+
+#include "statistics.hh"
+#include "system.hh"
 
 static std::string time_str(double s)
 {
@@ -46,18 +51,390 @@ void ct::benchmark_results::print_all(cc::string_view prefix) const
         for (auto const& t : baselines)
             print(t);
     }
+    if (has_cold())
+    {
+        std::cout << s_prefix << "cold experiments:" << std::endl;
+        for (auto const& t : cold_experiments)
+            print(t);
+        std::cout << s_prefix << "cold baseline:" << std::endl;
+        for (auto const& t : cold_baselines)
+            print(t);
+    }
 }
 
 void ct::benchmark_results::print_summary(cc::string_view prefix) const
 {
-    auto const bsps = baseline_seconds_per_sample();
-    auto const bcps = baseline_cycles_per_sample();
-    auto const sps_min = std::max(0.0, seconds_per_sample() - bsps);
-    auto const cps_min = std::max(0.0, cycles_per_sample() - bcps);
-    auto const sps_max = seconds_per_sample(0.7f);
-    auto const cps_max = cycles_per_sample(0.7f);
-    std::cout << cc::string(prefix).c_str() << time_str(sps_min) << " .. " << time_str(sps_max) << " / sample, " << cps_min << " .. " << cps_max
-              << " cycles / sample" << std::endl;
+    auto const& s = seconds_estimate;
+    auto const& c = cycles_estimate;
+    std::cout << cc::string(prefix).c_str() << time_str(s.median) << " [" << time_str(s.ci_low) << " .. " << time_str(s.ci_high) << "] / sample, "
+              << c.median << " [" << c.ci_low << " .. " << c.ci_high << "] cycles / sample (+-" << std::round(c.relative_ci() * 1000) / 10
+              << "%, " << c.runs << " runs, " << c.outliers << " outliers)" << std::endl;
+
+    if (has_cold())
+    {
+        auto const& cold_s = cold_seconds_estimate;
+        auto const& cold_c = cold_cycles_estimate;
+        std::cout << cc::string(prefix).c_str() << "  cold: " << time_str(cold_s.median) << " [" << time_str(cold_s.ci_low) << " .. "
+                  << time_str(cold_s.ci_high) << "] / sample, " << cold_c.median << " [" << cold_c.ci_low << " .. " << cold_c.ci_high
+                  << "] cycles / sample (" << cold_c.runs << " runs, " << cold_c.outliers << " outliers)" << std::endl;
+    }
+
+    auto const r = compute_counter_rates();
+    if (r.available)
+    {
+        std::cout << cc::string(prefix).c_str() << "  " << r.instructions << " instructions, " << r.cpu_cycles << " core cycles (IPC " << r.ipc
+                  << "), " << r.l1d_misses << " L1D misses, " << r.llc_misses << " LLC misses, " << r.branch_misses << " branch misses / sample"
+                  << std::endl;
+    }
+
+    if (ct::allocation_hooks_enabled())
+        std::cout << cc::string(prefix).c_str() << "  " << allocations_per_sample() << " allocations, " << allocated_bytes_per_sample()
+                  << " bytes / sample" << std::endl;
+
+    if (environment.controlled)
+    {
+        auto const& e = environment;
+        std::cout << cc::string(prefix).c_str() << "  core " << e.core << ", governor '" << e.governor.c_str() << "', " << e.frequency_mhz
+                  << " MHz, load " << e.load_average << ", " << (e.frequency_stable ? "stable" : "UNSTABLE") << " after "
+                  << time_str(e.warmup_seconds) << " warm-up, " << e.discarded_runs << " discarded run(s)"
+                  << (e.used_discarded_runs ? " (used anyway, estimate is unreliable)" : "") << std::endl;
+    }
+}
+
+namespace
+{
+// baseline subtracted median of the per-sample values of all kept runs
+template <class Get>
+ct::benchmark_results::estimate compute_estimate(cc::vector<ct::benchmark_results::timing> const& experiments,
+                                                 cc::vector<ct::benchmark_results::timing> const& baselines,
+                                                 Get&& get,
+                                                 int bootstrap_resamples,
+                                                 double outlier_threshold)
+{
+    ct::benchmark_results::estimate e;
+
+    cc::vector<double> base;
+    for (auto const& t : baselines)
+        base.push_back(get(t) / t.samples);
+    e.baseline = ct::median(base);
+
+    cc::vector<double> values;
+    for (auto const& t : experiments)
+        values.push_back(get(t) / t.samples);
+
+    e.outliers = ct::reject_outliers_mad(values, outlier_threshold);
+    e.runs = int(values.size());
+
+    auto const med = ct::median(values);
+    auto const ci = ct::bootstrap_median_ci(values, bootstrap_resamples);
+    e.mad = ct::median_absolute_deviation(values, med);
+    e.median = std::max(0.0, med - e.baseline);
+    e.ci_low = std::max(0.0, ci.low - e.baseline);
+    e.ci_high = std::max(0.0, ci.high - e.baseline);
+    return e;
+}
+
+double get_cycles(ct::benchmark_results::timing const& t) { return double(t.cycles); }
+double get_seconds(ct::benchmark_results::timing const& t) { return t.seconds; }
+}
+
+void ct::benchmark_results::compute_estimates(int bootstrap_resamples, double outlier_threshold)
+{
+    cycles_estimate = compute_estimate(experiments, baselines, get_cycles, bootstrap_resamples, outlier_threshold);
+    seconds_estimate = compute_estimate(experiments, baselines, get_seconds, bootstrap_resamples, outlier_threshold);
+
+    if (has_cold())
+    {
+        cold_cycles_estimate = compute_estimate(cold_experiments, cold_baselines, get_cycles, bootstrap_resamples, outlier_threshold);
+        cold_seconds_estimate = compute_estimate(cold_experiments, cold_baselines, get_seconds, bootstrap_resamples, outlier_threshold);
+    }
+}
+
+namespace
+{
+// spins until the time for a fixed amount of dependent work is stable, i.e. the core has reached its steady frequency
+// NOTE: the TSC is invariant on modern CPUs, so the TSC rate alone cannot show frequency changes
+void warm_up_frequency(ct::benchmark_config const& cfg, ct::benchmark_results::environment_info& env)
+{
+    auto constexpr spin_iterations = 200'000;
+    auto constexpr stable_measurements = 5;
+
+    auto const t_start = std::chrono::steady_clock::now();
+    auto const c_start = ct::current_cycles();
+
+    auto prev_cycles = 0.0;
+    auto stable_cnt = 0;
+    while (true)
+    {
+        volatile uint64_t x = 0;
+        auto const c0 = ct::current_cycles();
+        for (auto i = 0; i < spin_iterations; ++i)
+            x = x + 1;
+        auto const cycles = double(ct::current_cycles() - c0);
+
+        if (prev_cycles > 0 && std::abs(cycles / prev_cycles - 1) <= cfg.frequency_tolerance)
+            ++stable_cnt;
+        else
+            stable_cnt = 0;
+        prev_cycles = cycles;
+
+        env.warmup_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+        if (stable_cnt >= stable_measurements)
+        {
+            env.frequency_stable = true;
+            break;
+        }
+        if (env.warmup_seconds >= cfg.max_warmup_seconds)
+            break;
+    }
+
+    if (env.warmup_seconds > 0)
+        env.tsc_cycles_per_second = double(ct::current_cycles() - c_start) / env.warmup_seconds;
+}
+
+bool is_disturbed(ct::benchmark_results::timing const& t, ct::benchmark_results::environment_info const& env, double max_mismatch)
+{
+    auto constexpr min_seconds_for_check = 50e-6; // below this the wall clock is too coarse
+
+    if (t.migrated)
+        return true;
+
+    if (t.seconds >= min_seconds_for_check && env.tsc_cycles_per_second > 0)
+        return std::abs(t.cycles / t.seconds / env.tsc_cycles_per_second - 1) > max_mismatch;
+
+    return false;
+}
+}
+
+ct::benchmark_results::counter_rates ct::benchmark_results::compute_counter_rates() const
+{
+    counter_rates r;
+
+    auto const rate = [&](auto&& get) -> double
+    {
+        cc::vector<double> exp;
+        for (auto const& t : experiments)
+            if (t.has_counters)
+                exp.push_back(double(get(t.counters)) / t.samples);
+
+        cc::vector<double> base;
+        for (auto const& t : baselines)
+            if (t.has_counters)
+                base.push_back(double(get(t.counters)) / t.samples);
+
+        return std::max(0.0, ct::median(exp) - ct::median(base));
+    };
+
+    r.available = std::any_of(experiments.begin(), experiments.end(), [](timing const& t) { return t.has_counters; });
+    if (!r.available)
+        return r;
+
+    r.instructions = rate([](counter_values const& v) { return v.instructions; });
+    r.cpu_cycles = rate([](counter_values const& v) { return v.cpu_cycles; });
+    r.ipc = r.cpu_cycles > 0 ? r.instructions / r.cpu_cycles : 0.0;
+    r.l1d_misses = rate([](counter_values const& v) { return v.l1d_misses; });
+    r.llc_misses = rate([](counter_values const& v) { return v.llc_misses; });
+    r.branch_misses = rate([](counter_values const& v) { return v.branch_misses; });
+    return r;
+}
+
+namespace
+{
+double per_sample_median_rate(ct::benchmark_results const& r, uint64_t ct::benchmark_results::timing::*member)
+{
+    cc::vector<double> exp;
+    for (auto const& t : r.experiments)
+        exp.push_back(double(t.*member) / t.samples);
+
+    cc::vector<double> base;
+    for (auto const& t : r.baselines)
+        base.push_back(double(t.*member) / t.samples);
+
+    return std::max(0.0, ct::median(exp) - ct::median(base));
+}
+}
+
+double ct::benchmark_results::allocations_per_sample() const { return per_sample_median_rate(*this, &timing::allocations); }
+double ct::benchmark_results::allocated_bytes_per_sample() const { return per_sample_median_rate(*this, &timing::allocated_bytes); }
+
+namespace
+{
+// an estimate from disturbed runs is better than a silent 0, so they are used if nothing else is left
+void use_discarded_if_empty(cc::vector<ct::benchmark_results::timing>& runs,
+                            size_t initial_runs,
+                            cc::vector<ct::benchmark_results::timing> const& discarded,
+                            ct::benchmark_results::environment_info& env)
+{
+    if (runs.size() > initial_runs || discarded.empty())
+        return;
+
+    std::cerr << "[ctracer] all " << discarded.size() << " benchmark runs were discarded (core migrations or TSC/wall-clock mismatch), "
+              << "using them anyway" << std::endl;
+    for (auto const& t : discarded)
+        runs.push_back(t);
+    env.used_discarded_runs = true;
+}
+
+// adds runs of cluster_cnt executions until the baseline subtracted median is known precisely enough or the time budget is exhausted
+// NOTE: baselines must already be measured, their uncertainty widens the confidence interval
+void add_adaptive_runs(ct::benchmark_config const& cfg,
+                       ct::detail::timing_fun experiment,
+                       int cluster_cnt,
+                       cc::vector<ct::benchmark_results::timing> const& baselines,
+                       cc::vector<ct::benchmark_results::timing>& runs,
+                       ct::benchmark_results::environment_info& env)
+{
+    auto constexpr adaptive_resamples = 200; // cheaper bootstrap while deciding if more runs are needed
+
+    cc::vector<double> base;
+    for (auto const& t : baselines)
+        base.push_back(get_cycles(t) / t.samples);
+    auto const base_ci = ct::bootstrap_median_ci(base, adaptive_resamples);
+    auto const base_half_width = (base_ci.high - base_ci.low) / 2;
+
+    auto const t_start = std::chrono::steady_clock::now();
+    auto const elapsed = [&] { return std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count(); };
+    auto const check_interval = std::max(1, cfg.min_runs);
+    auto const initial_runs = int(runs.size());
+    cc::vector<ct::benchmark_results::timing> discarded;
+    auto attempts = 0;
+    while (int(runs.size()) - initial_runs < cfg.max_runs && attempts++ < 2 * cfg.max_runs)
+    {
+        auto const t = experiment(cluster_cnt);
+        if (cfg.control_environment && is_disturbed(t, env, cfg.max_tsc_mismatch))
+        {
+            env.discarded_runs++;
+            discarded.push_back(t);
+            if (elapsed() >= cfg.max_seconds)
+                break;
+            continue;
+        }
+        runs.push_back(t);
+
+        auto const run_cnt = int(runs.size());
+        if (elapsed() >= cfg.max_seconds)
+            break;
+        if (run_cnt < cfg.min_runs || run_cnt % check_interval != 0)
+            continue;
+
+        auto const e = compute_estimate(runs, baselines, get_cycles, adaptive_resamples, cfg.outlier_threshold);
+        if (e.median > 0 && ((e.ci_high - e.ci_low) / 2 + base_half_width) / e.median <= cfg.target_relative_ci)
+            break;
+    }
+
+    use_discarded_if_empty(runs, size_t(initial_runs), discarded, env);
+}
+
+void add_baseline_runs(ct::benchmark_config const& cfg,
+                       ct::detail::timing_fun baseline,
+                       int cluster_cnt,
+                       cc::vector<ct::benchmark_results::timing>& runs,
+                       ct::benchmark_results::environment_info& env)
+{
+    auto const initial_runs = runs.size();
+    cc::vector<ct::benchmark_results::timing> discarded;
+    for (auto i = 0; i < cfg.baseline_runs; ++i)
+    {
+        auto const t = baseline(cluster_cnt);
+        if (cfg.control_environment && is_disturbed(t, env, cfg.max_tsc_mismatch))
+        {
+            env.discarded_runs++;
+            discarded.push_back(t);
+        }
+        else
+            runs.push_back(t);
+    }
+
+    use_discarded_if_empty(runs, initial_runs, discarded, env);
+}
+}
+
+ct::benchmark_results ct::detail::run_benchmark(benchmark_config const& cfg,
+                                                timing_fun experiment,
+                                                timing_fun baseline,
+                                                timing_fun const* cold_experiment,
+                                                timing_fun const* cold_baseline,
+                                                int cold_cluster_cnt)
+{
+    auto constexpr initial_check_cnt = 3;
+    auto constexpr max_cluster_cnt = 1 << 20;
+
+    benchmark_results res;
+
+    // optional environment control
+    auto const core = cfg.pin_core >= 0 ? cfg.pin_core : ct::current_core();
+    auto const pin = ct::scoped_thread_pin(cfg.control_environment ? core : -1);
+    auto& env = res.environment;
+    if (cfg.control_environment)
+    {
+        env.controlled = true;
+        env.core = pin.is_pinned() ? core : -1;
+        warm_up_frequency(cfg, env);
+        env.governor = ct::cpu_governor(core);
+        env.frequency_mhz = ct::cpu_frequency_mhz(core);
+        env.load_average = ct::load_average();
+    }
+
+    // gauge function running time
+    auto t_init = experiment(1);
+    res.warmups.push_back(t_init);
+    for (auto i = 1; i < initial_check_cnt; ++i)
+    {
+        auto t = experiment(1);
+        res.warmups.push_back(t);
+        if (t.cycles < t_init.cycles)
+            t_init = t;
+    }
+
+    // function takes too long to do more than one run
+    if (t_init.seconds >= cfg.max_seconds)
+    {
+        res.experiments.push_back(t_init);
+        if (cold_experiment)
+            res.cold_experiments.push_back((*cold_experiment)(1));
+        res.compute_estimates(cfg.bootstrap_resamples, cfg.outlier_threshold);
+        return res;
+    }
+
+    // cluster executions so that each run is long enough to be measured accurately
+    auto const cluster_cnt = int(std::clamp<uint64_t>(cfg.min_run_cycles / std::max<uint64_t>(1, t_init.cycles), 1, max_cluster_cnt));
+
+    // baseline with same clustering first, so that the adaptive runs can check the baseline subtracted precision
+    add_baseline_runs(cfg, baseline, cluster_cnt, res.baselines, env);
+    add_adaptive_runs(cfg, experiment, cluster_cnt, res.baselines, res.experiments, env);
+
+    // cold runs get their own time budget
+    if (cold_experiment)
+    {
+        auto const cold_cluster = cold_cluster_cnt > 0 ? cold_cluster_cnt : cluster_cnt;
+        add_baseline_runs(cfg, cold_baseline ? *cold_baseline : baseline, cold_cluster, res.cold_baselines, env);
+        add_adaptive_runs(cfg, *cold_experiment, cold_cluster, res.cold_baselines, res.cold_experiments, env);
+    }
+
+    res.compute_estimates(cfg.bootstrap_resamples, cfg.outlier_threshold);
+    return res;
+}
+
+void ct::detail::evict_caches(size_t bytes)
+{
+    auto constexpr cache_line = 64;
+    auto constexpr fallback_bytes = size_t(64) << 20;
+
+    if (bytes == 0)
+    {
+        static auto const llc = ct::last_level_cache_bytes();
+        bytes = llc > 0 ? 2 * llc : fallback_bytes;
+    }
+
+    // written (not only read) so that dirty lines of the measured data are written back as well
+    thread_local std::vector<uint64_t> buffer;
+    if (buffer.size() * sizeof(uint64_t) < bytes)
+        buffer.resize(bytes / sizeof(uint64_t) + 1);
+
+    uint64_t sum = 0;
+    for (size_t i = 0; i < buffer.size(); i += cache_line / sizeof(uint64_t))
+        sum += buffer[i]++;
+    ct::sink << sum;
 }
 
 double ct::benchmark_results::seconds_per_sample(float percentile) const
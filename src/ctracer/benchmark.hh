@@ -1,9 +1,11 @@
 #pragma once
 
+#include <algorithm>
 #include <chrono>
 #include <limits>
 #include <type_traits>
 
+#include <clean-core/function_ref.hh>
 #include <clean-core/is_range.hh>
 #include <clean-core/string.hh>
 #include <clean-core/vector.hh>
@@ -11,6 +13,8 @@
 // TODO: replace by cc once tuple conversion is added
 #include <tuple>
 
+#include "alloc-hooks.hh"
+#include "perf-counters.hh"
 #include "trace.hh"
 
 /*
@@ -23,6 +27,26 @@
  *
  *   ct::benchmark([](int a, int b) { return a % b; }, 17, 5);
  *
+ *   ct::benchmark_config cfg;
+ *   cfg.target_relative_ci = 0.005; // run until the median is known within +-0.5% ...
+ *   cfg.max_seconds = 5;            // ... or 5 seconds are spent
+ *   ct::benchmark(cfg, foo, 1);
+ *
+ * Cold caches:
+ *   cfg.measure_cold_cache = true; // additionally time single executions after evicting all caches
+ *   auto res = ct::benchmark(cfg, foo, 1);
+ *   res.cold_cycles_estimate; // next to res.cycles_estimate (warm)
+ *
+ *   // rotates through 1000 generated inputs (cold) vs. always using the first one (warm)
+ *   // (the inputs should be larger than the last-level cache in total)
+ *   ct::benchmark_inputs(cfg, [](std::vector<int> const& v) { return sum(v); }, [](size_t i) { return make_data(i); }, 1000);
+ *
+ * Fresh state per execution (setup and teardown are not timed):
+ *   ct::benchmark_fixture(
+ *       cfg, [] { return make_unsorted_array(); },       // setup, returns the state
+ *       [](std::vector<int>& v) { std::sort(v.begin(), v.end()); }, // run, timed
+ *       [](std::vector<int>& v) { check_sorted(v); });    // optional teardown
+ *
  * How to prevent optimization (manual version):
  *   ct::sink << x; // writes value to volatile var (guaranteed write)
  *   auto const s = ct::source(0.0f);
@@ -92,6 +116,53 @@ private:
     volatile T value;
 };
 
+struct benchmark_config
+{
+    /// runs are added until the 95% confidence interval of the median is within +-target_relative_ci ...
+    double target_relative_ci = 0.01;
+    /// ... or the time budget (in seconds, for all experiment runs) is exhausted
+    double max_seconds = 1.0;
+
+    int min_runs = 10;
+    int max_runs = 1000;
+    int baseline_runs = 30;
+
+    /// each run executes the function often enough to take at least this many cycles
+    uint64_t min_run_cycles = 100'000;
+
+    /// runs with a modified z-score (based on the median absolute deviation) above this are discarded
+    double outlier_threshold = 3.5;
+
+    /// number of bootstrap resamples for the final confidence interval
+    int bootstrap_resamples = 1000;
+
+    /// opt-in environment control:
+    ///   - pins the thread to a core (pin_core or the current one if -1)
+    ///   - spins until the core frequency is stable (within frequency_tolerance, at most max_warmup_seconds)
+    ///   - discards runs with a core migration (rdtscp processor id) or a cycles/seconds ratio that
+    ///     deviates more than max_tsc_mismatch from the calibrated one
+    ///   - records governor, frequency, and load in benchmark_results::environment
+    bool control_environment = false;
+    int pin_core = -1;
+    double frequency_tolerance = 0.005;
+    double max_warmup_seconds = 2.0;
+    double max_tsc_mismatch = 0.05;
+
+    /// opt-in hardware counters (instructions, core cycles, L1D/LLC misses, branch misses) for each run
+    /// NOTE: falls back to no counters if perf_event_open is not available or restricted
+    bool hardware_counters = false;
+
+    /// opt-in cold-cache runs in addition to the warm ones (kept separately in benchmark_results::cold_*)
+    /// each execution is preceded by streaming through an eviction buffer (outside of the timed region)
+    /// NOTE: cold runs time single executions, the timer overhead is removed via the (equally cold) baseline
+    bool measure_cold_cache = false;
+    /// size of the eviction buffer in bytes (0 means twice the last-level cache)
+    size_t eviction_bytes = 0;
+
+    /// benchmark_fixture: at most this many states are set up before timing run() on them back-to-back
+    int max_setup_batch = 256;
+};
+
 struct benchmark_results
 {
     struct timing
@@ -99,12 +170,92 @@ struct benchmark_results
         int samples = 0;
         uint64_t cycles = 0;
         double seconds = 0;
+        bool migrated = false; ///< processor id differed between start and end
+
+        bool has_counters = false;
+        counter_values counters;
+
+        /// heap allocations during the run (only counted if CT_DEFINE_ALLOCATION_HOOKS() is used)
+        uint64_t allocations = 0;
+        uint64_t allocated_bytes = 0;
+
+        /// accumulates another timing into this one (e.g. several individually timed executions)
+        void add(timing const& t)
+        {
+            has_counters = (samples == 0 || has_counters) && t.has_counters; // all parts need counters
+            samples += t.samples;
+            cycles += t.cycles;
+            seconds += t.seconds;
+            migrated = migrated || t.migrated;
+            counters = counters + t.counters;
+            allocations += t.allocations;
+            allocated_bytes += t.allocated_bytes;
+        }
+    };
+
+    /// per-sample hardware counter rates (baseline subtracted medians)
+    struct counter_rates
+    {
+        bool available = false;
+        double instructions = 0;
+        double cpu_cycles = 0;
+        double ipc = 0; ///< instructions per core cycle
+        double l1d_misses = 0;
+        double llc_misses = 0;
+        double branch_misses = 0;
+    };
+
+    /// state of the machine during the benchmark (only filled if benchmark_config::control_environment is set)
+    struct environment_info
+    {
+        bool controlled = false;
+        int core = -1; ///< pinned core (-1 if pinning failed)
+        cc::string governor;
+        double frequency_mhz = 0; ///< as reported by the OS after warm-up
+        double load_average = -1;
+        double tsc_cycles_per_second = 0; ///< calibrated during warm-up
+        double warmup_seconds = 0;
+        bool frequency_stable = false;    ///< false if warm-up timed out
+        int discarded_runs = 0;           ///< due to migrations or TSC/wall-clock mismatch
+        bool used_discarded_runs = false; ///< all runs of a kind were discarded and are used anyway (unreliable estimate)
+    };
+
+    /// robust per-sample estimate
+    struct estimate
+    {
+        double median = 0; ///< baseline subtracted
+        double ci_low = 0; ///< baseline subtracted (95% bootstrap confidence interval of the median)
+        double ci_high = 0;
+        double mad = 0;      ///< median absolute deviation of the (kept) runs
+        double baseline = 0; ///< median of the baseline (already subtracted from median and ci)
+        int runs = 0;        ///< number of runs used for the estimate
+        int outliers = 0;    ///< number of discarded runs
+
+        /// half-width of the confidence interval relative to the median
+        /// NOTE: infinite if the (baseline subtracted) median is not positive, i.e. the relative precision is unknown
+        double relative_ci() const { return median > 0 ? (ci_high - ci_low) / (2 * median) : std::numeric_limits<double>::infinity(); }
     };
 
     cc::vector<timing> experiments;
     cc::vector<timing> warmups;
     cc::vector<timing> baselines;
 
+    estimate cycles_estimate;
+    estimate seconds_estimate;
+
+    /// cold-cache runs (see benchmark_config::measure_cold_cache and benchmark_inputs)
+    cc::vector<timing> cold_experiments;
+    cc::vector<timing> cold_baselines;
+    estimate cold_cycles_estimate;
+    estimate cold_seconds_estimate;
+
+    environment_info environment;
+
+    bool has_cold() const { return !cold_experiments.empty(); }
+
+    /// (re-)computes all estimates from the raw timings
+    void compute_estimates(int bootstrap_resamples = 1000, double outlier_threshold = 3.5);
+
     void print_all(cc::string_view prefix = "") const;
     void print_summary(cc::string_view prefix = "") const;
 
@@ -112,10 +263,70 @@ struct benchmark_results
     double cycles_per_sample(float percentile = 0.0f) const;
     double baseline_seconds_per_sample() const;
     double baseline_cycles_per_sample() const;
+
+    /// computes per-sample counter rates from runs with hardware counters
+    counter_rates compute_counter_rates() const;
+
+    /// heap allocations per sample (baseline subtracted median, 0 if allocation hooks are not enabled)
+    double allocations_per_sample() const;
+    double allocated_bytes_per_sample() const;
 };
 
+namespace detail
+{
+using timing_fun = cc::function_ref<benchmark_results::timing(int count)>;
+
+/// adaptive benchmark driver, experiment and baseline time "count" back-to-back executions
+/// optional cold runs are measured afterwards with cold_cluster_cnt executions per run (0: same as the warm runs)
+benchmark_results run_benchmark(benchmark_config const& cfg,
+                                timing_fun experiment,
+                                timing_fun baseline,
+                                timing_fun const* cold_experiment = nullptr,
+                                timing_fun const* cold_baseline = nullptr,
+                                int cold_cluster_cnt = 0);
+
+/// streams through a (thread-local) buffer of the given size to evict the caches (0: twice the last-level cache)
+void evict_caches(size_t bytes);
+
+/// times "count" back-to-back executions of code, counters and allocations are read outside of the timed region
+template <class F>
+benchmark_results::timing time_executions(perf_counters const& counters, F&& code, int count)
+{
+    auto const a_start = get_thread_alloc_counters();
+    counter_values v_start;
+    if (counters.is_available())
+        v_start = counters.read();
+
+    uint32_t cpu_start, cpu_end;
+    auto t_start = std::chrono::high_resolution_clock::now();
+    auto c_start = ct::current_cycles(cpu_start);
+    for (auto i = 0; i < count; ++i)
+        code();
+    auto c_end = ct::current_cycles(cpu_end);
+    auto t_end = std::chrono::high_resolution_clock::now();
+
+    benchmark_results::timing t;
+    t.samples = count;
+    t.cycles = c_end - c_start;
+    t.seconds = std::chrono::duration<double>(t_end - t_start).count();
+    t.migrated = cpu_start != cpu_end;
+    if (counters.is_available())
+    {
+        // multiplexed counters are extrapolated, never scheduled ones are reported as missing instead of zero
+        auto const delta = counters.read() - v_start;
+        t.has_counters = delta.is_valid();
+        if (t.has_counters)
+            t.counters = delta.scaled();
+    }
+    auto const a_end = get_thread_alloc_counters();
+    t.allocations = a_end.allocations - a_start.allocations;
+    t.allocated_bytes = a_end.allocated_bytes - a_start.allocated_bytes;
+    return t;
+}
+}
+
 template <class F, class... Args>
-benchmark_results benchmark(F&& f, Args... args)
+benchmark_results benchmark(benchmark_config const& cfg, F&& f, Args... args)
 {
     static_assert(std::is_invocable_v<F, Args...>, "f is not invocable with the provided parameters");
     using R = std::invoke_result_t<F, Args...>;
@@ -124,29 +335,6 @@ benchmark_results benchmark(F&& f, Args... args)
     auto args_src = std::tuple{source<Args>(args)...};
     auto args_in = std::tuple{args...};
 
-    auto constexpr initial_check_cnt = 3;
-    auto constexpr extra_long_cycles = 100'000'000; // above this only initial check is executed
-    auto constexpr long_cycles = 1'000'000;         // above this a few individual runs are performed
-    auto constexpr medium_cycles = 10000;           // above this a few clustered runs are performed
-    auto constexpr short_cycles = 500;              // above this a some clustered runs are performed
-
-    auto constexpr long_run_cnt = 5;
-    auto constexpr long_cluster_cnt = 1;
-
-    auto constexpr medium_run_cnt = 5;
-    auto constexpr medium_cluster_cnt = 5;
-
-    auto constexpr short_run_cnt = 15;
-    auto constexpr short_cluster_cnt = 200;
-
-    auto constexpr very_short_run_cnt = 30;
-    auto constexpr very_short_cluster_cnt = 3000;
-
-    auto constexpr baseline_run_cnt = 30;
-    auto constexpr baseline_cluster_cnt = 3000;
-
-    benchmark_results res;
-
     auto const execute = [&]
     {
         // read inputs from sources
@@ -166,72 +354,173 @@ benchmark_results benchmark(F&& f, Args... args)
             sink << R{}; // write
     };
 
-    auto const time = [&](auto&& code, int count) -> benchmark_results::timing
+    auto const counters = perf_counters(cfg.hardware_counters);
+    auto const time = [&](auto&& code, int count) { return detail::time_executions(counters, code, count); };
+    auto const warm_experiment = [&](int count) { return time(execute, count); };
+    auto const warm_baseline = [&](int count) { return time(baseline, count); };
+
+    if (!cfg.measure_cold_cache)
+        return detail::run_benchmark(cfg, warm_experiment, warm_baseline);
+
+    auto const time_cold = [&](auto&& code, int count)
     {
-        auto t_start = std::chrono::high_resolution_clock::now();
-        auto c_start = ct::current_cycles();
+        benchmark_results::timing t;
         for (auto i = 0; i < count; ++i)
-            code();
-        auto c_end = ct::current_cycles();
-        auto t_end = std::chrono::high_resolution_clock::now();
-        return {count, c_end - c_start, std::chrono::duration<double>(t_end - t_start).count()};
+        {
+            detail::evict_caches(cfg.eviction_bytes);
+            t.add(time(code, 1));
+        }
+        return t;
     };
+    auto const cold_experiment = [&](int count) { return time_cold(execute, count); };
+    auto const cold_baseline = [&](int count) { return time_cold(baseline, count); };
+
+    detail::timing_fun const cold_experiment_fun = cold_experiment;
+    detail::timing_fun const cold_baseline_fun = cold_baseline;
+    return detail::run_benchmark(cfg, warm_experiment, warm_baseline, &cold_experiment_fun, &cold_baseline_fun, 1);
+}
+
+template <class F, class... Args, class = std::enable_if_t<!std::is_same_v<std::decay_t<F>, benchmark_config>>>
+benchmark_results benchmark(F&& f, Args... args)
+{
+    return ct::benchmark(benchmark_config{}, f, args...);
+}
+
+/// benchmarks f on generated inputs: generator(i) creates the i-th of input_count inputs (before any measurement)
+/// warm runs always pass the first input, cold runs rotate through all inputs
+/// NOTE: choose input_count such that all inputs together exceed the last-level cache
+template <class F, class G>
+benchmark_results benchmark_inputs(benchmark_config const& cfg, F&& f, G&& generator, size_t input_count)
+{
+    using T = std::decay_t<std::invoke_result_t<G, size_t>>;
+    static_assert(std::is_invocable_v<F, T&>, "f is not invocable with the generated inputs");
+    using R = std::invoke_result_t<F, T&>;
+    static_assert(std::is_same_v<R, void> || std::is_default_constructible_v<std::decay_t<R>>, "requires default-constructible return type of f");
+
+    cc::vector<T> inputs;
+    inputs.reserve(std::max<size_t>(1, input_count));
+    for (size_t i = 0; i < std::max<size_t>(1, input_count); ++i)
+        inputs.push_back(generator(i));
 
-    benchmark_results::timing t_init;
+    auto const first = source<size_t>(0);
+    size_t next = 0;
 
-    // gauge function running time
+    auto const run = [&](T& input)
     {
-        auto c_min = std::numeric_limits<uint64_t>::max();
-        auto i_min = 0;
-        for (auto i = 0; i < initial_check_cnt; ++i)
-        {
-            auto t = time(execute, 1);
-            res.warmups.push_back(t);
-
-            if (t.cycles < c_min)
-            {
-                c_min = t.cycles;
-                i_min = i;
-            }
-        }
-        t_init = res.warmups[size_t(i_min)];
-    }
+        if constexpr (std::is_same_v<R, void>)
+            f(input);
+        else // sinking result
+            sink << f(input);
+    };
 
-    // function takes too long to do more than one run
-    if (t_init.cycles > extra_long_cycles)
+    auto const warm = [&] { run(inputs[first]); };
+    auto const cold = [&]
     {
-        res.experiments.push_back(t_init);
-    }
-    // a few individual runs are ok
-    else if (t_init.cycles > long_cycles)
+        run(inputs[next]);
+        if (++next == inputs.size())
+            next = 0;
+    };
+    auto const warm_baseline = [&]
     {
-        res.experiments.push_back(t_init);
-        for (auto i = 0; i < long_run_cnt; ++i)
-            res.experiments.push_back(time(execute, long_cluster_cnt));
-    }
-    // a few clustered runs
-    else if (t_init.cycles > medium_cycles)
+        sink << &inputs[first];
+        if constexpr (!std::is_same_v<R, void>)
+            sink << std::decay_t<R>{};
+    };
+    auto const cold_baseline = [&]
     {
-        for (auto i = 0; i < medium_run_cnt; ++i)
-            res.experiments.push_back(time(execute, medium_cluster_cnt));
-    }
-    // some clustered runs
-    else if (t_init.cycles > short_cycles)
+        sink << &inputs[next];
+        if (++next == inputs.size())
+            next = 0;
+        if constexpr (!std::is_same_v<R, void>)
+            sink << std::decay_t<R>{};
+    };
+
+    auto const counters = perf_counters(cfg.hardware_counters);
+    auto const time = [&](auto&& code, int count) { return detail::time_executions(counters, code, count); };
+
+    auto const cold_experiment = [&](int count) { return time(cold, count); };
+    auto const cold_baseline_timing = [&](int count) { return time(cold_baseline, count); };
+    detail::timing_fun const cold_experiment_fun = cold_experiment;
+    detail::timing_fun const cold_baseline_fun = cold_baseline_timing;
+    return detail::run_benchmark(
+        cfg, [&](int count) { return time(warm, count); }, [&](int count) { return time(warm_baseline, count); }, &cold_experiment_fun,
+        &cold_baseline_fun);
+}
+
+/// benchmarks run(state) where each execution gets a fresh state from setup()
+/// setup() and teardown(state) are not timed: states are set up in batches (at most cfg.max_setup_batch),
+/// run() is timed back-to-back on the whole batch, then the batch is torn down
+/// the baseline (an empty run() with the same batching) removes the overhead of starting and stopping the timer
+template <class Setup, class Run, class Teardown>
+benchmark_results benchmark_fixture(benchmark_config const& cfg, Setup&& setup, Run&& run, Teardown&& teardown)
+{
+    using T = std::decay_t<std::invoke_result_t<Setup>>;
+    static_assert(!std::is_same_v<T, void>, "setup() must return the state passed to run()");
+    static_assert(std::is_invocable_v<Run, T&>, "run is not invocable with the state returned by setup()");
+    static_assert(std::is_invocable_v<Teardown, T&>, "teardown is not invocable with the state returned by setup()");
+    using R = std::invoke_result_t<Run, T&>;
+    static_assert(std::is_same_v<R, void> || std::is_default_constructible_v<std::decay_t<R>>, "requires default-constructible return type of run");
+
+    auto const execute = [&](T& state)
     {
-        for (auto i = 0; i < short_run_cnt; ++i)
-            res.experiments.push_back(time(execute, short_cluster_cnt));
-    }
-    // heavily clustered runs
-    else
+        if constexpr (std::is_same_v<R, void>)
+            run(state);
+        else // sinking result
+            sink << run(state);
+    };
+
+    auto const baseline = [&](T& state)
     {
-        for (auto i = 0; i < very_short_run_cnt; ++i)
-            res.experiments.push_back(time(execute, very_short_cluster_cnt));
-    }
+        sink << &state;
+        if constexpr (!std::is_same_v<R, void>)
+            sink << std::decay_t<R>{};
+    };
+
+    auto const counters = perf_counters(cfg.hardware_counters);
+    auto const max_batch = std::max(1, cfg.max_setup_batch);
+    cc::vector<T> states;
 
-    // baseline
-    for (auto i = 0; i < baseline_run_cnt; ++i)
-        res.baselines.push_back(time(baseline, baseline_cluster_cnt));
+    // baseline batches only destroy their states, teardown might rely on run() having happened
+    auto const time_batches = [&](auto&& code, int count, bool cold, bool is_baseline)
+    {
+        benchmark_results::timing t;
+        while (count > 0)
+        {
+            auto const n = cold ? 1 : std::min(count, max_batch);
+
+            states.clear();
+            for (auto i = 0; i < n; ++i)
+                states.push_back(setup());
+            if (cold)
+                detail::evict_caches(cfg.eviction_bytes);
+
+            size_t idx = 0;
+            t.add(detail::time_executions(counters, [&] { code(states[idx++]); }, n));
+
+            if (!is_baseline)
+                for (auto& s : states)
+                    teardown(s);
+            count -= n;
+        }
+        return t;
+    };
+
+    auto const warm_experiment = [&](int count) { return time_batches(execute, count, false, false); };
+    auto const warm_baseline = [&](int count) { return time_batches(baseline, count, false, true); };
+
+    if (!cfg.measure_cold_cache)
+        return detail::run_benchmark(cfg, warm_experiment, warm_baseline);
 
-    return res;
+    auto const cold_experiment = [&](int count) { return time_batches(execute, count, true, false); };
+    auto const cold_baseline = [&](int count) { return time_batches(baseline, count, true, true); };
+    detail::timing_fun const cold_experiment_fun = cold_experiment;
+    detail::timing_fun const cold_baseline_fun = cold_baseline;
+    return detail::run_benchmark(cfg, warm_experiment, warm_baseline, &cold_experiment_fun, &cold_baseline_fun, 1);
+}
+
+template <class Setup, class Run>
+benchmark_results benchmark_fixture(benchmark_config const& cfg, Setup&& setup, Run&& run)
+{
+    return ct::benchmark_fixture(cfg, setup, run, [](auto&) {});
 }
 }
@@ -9,10 +9,12 @@
 namespace ct
 {
 class ChunkAllocator;
+struct scope;
 
 namespace detail
 {
 void update_current_chunk_size();
+void reset_scope(scope& s);
 }
 
 /// an opaque block of memory for storing trace data
@@ -78,5 +80,6 @@ private:
 
     friend class ChunkAllocator;
     friend void detail::update_current_chunk_size();
+    friend void detail::reset_scope(scope& s);
 };
 }
@@ -0,0 +1,338 @@
+#include "compression.hh"
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include <ctracer/trace-config.hh>
+
+#include "detail.hh"
+
+using namespace ct;
+
+namespace
+{
+std::atomic<bool> _compression_enabled = false;
+
+// background compression of retired chunks
+struct compression_worker
+{
+    std::mutex mutex;
+    std::deque<std::weak_ptr<detail::retired_chunk>> queue; // expired if the scope no longer needs it
+    std::thread thread;
+    std::condition_variable queue_cv;
+    std::condition_variable idle_cv;
+    bool is_busy = false;
+    bool is_stopped = false;
+
+    ~compression_worker()
+    {
+        mutex.lock();
+        is_stopped = true;
+        mutex.unlock();
+        queue_cv.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            queue_cv.wait(lock, [&] { return is_stopped || !queue.empty(); });
+            if (queue.empty())
+                return;
+
+            auto c = queue.front().lock();
+            queue.pop_front();
+            is_busy = true;
+            lock.unlock();
+
+            if (c)
+                detail::compress_retired_chunk(*c);
+            c.reset(); // might free the chunk
+
+            lock.lock();
+            is_busy = false;
+            idle_cv.notify_all();
+        }
+    }
+};
+
+compression_worker& worker()
+{
+    static compression_worker w;
+    return w;
+}
+
+//
+// stage 1: records -> deltas as varints
+//
+// per record: varint(zigzag(cpu delta) << 1 | is_end), [begin only: varint(zigzag(location delta))], varint(zigzag(cycles delta))
+//
+
+uint64_t zigzag(int64_t v) { return (uint64_t(v) << 1) ^ uint64_t(v >> 63); }
+int64_t unzigzag(uint64_t v) { return int64_t(v >> 1) ^ -int64_t(v & 1); }
+
+template <class Out>
+void put_varint(Out& out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back(uint8_t(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(uint8_t(v));
+}
+
+uint64_t get_varint(uint8_t const*& p)
+{
+    uint64_t v = 0;
+    for (auto shift = 0;; shift += 7)
+    {
+        auto const b = *p++;
+        v |= uint64_t(b & 0x7F) << shift;
+        if (b < 0x80)
+            return v;
+    }
+}
+
+//
+// stage 2: LZ77-style byte codec
+//
+// sequence of: varint(literal count), literals, varint(match length - min_match + 1 or 0 for end), [varint(match offset)]
+//
+
+auto constexpr min_match = 4;
+auto constexpr hash_bits = 14;
+
+uint32_t hash4(uint8_t const* p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - hash_bits);
+}
+
+template <class Out>
+void lz_compress(std::vector<uint8_t> const& in, Out& out)
+{
+    auto const n = in.size();
+    std::vector<int64_t> table(1 << hash_bits, -1);
+
+    size_t lit_start = 0;
+    size_t i = 0;
+    while (i + min_match <= n)
+    {
+        auto const h = hash4(in.data() + i);
+        auto const cand = table[h];
+        table[h] = int64_t(i);
+
+        if (cand < 0 || std::memcmp(in.data() + cand, in.data() + i, min_match) != 0)
+        {
+            ++i;
+            continue;
+        }
+
+        size_t len = min_match;
+        while (i + len < n && in[size_t(cand) + len] == in[i + len])
+            ++len;
+
+        put_varint(out, i - lit_start);
+        for (auto k = lit_start; k < i; ++k)
+            out.push_back(in[k]);
+        put_varint(out, len - min_match + 1);
+        put_varint(out, i - size_t(cand));
+
+        i += len;
+        lit_start = i;
+    }
+
+    put_varint(out, n - lit_start);
+    for (auto k = lit_start; k < n; ++k)
+        out.push_back(in[k]);
+    put_varint(out, 0);
+}
+
+/// NOTE: out must have the exact decompressed size
+void lz_decompress(uint8_t const* p, uint8_t const* end, uint8_t* out)
+{
+    while (p < end)
+    {
+        auto const lits = get_varint(p);
+        std::memcpy(out, p, lits);
+        out += lits;
+        p += lits;
+
+        auto const m = get_varint(p);
+        if (m == 0)
+            return;
+        auto const len = m + min_match - 1;
+        auto const offset = get_varint(p);
+
+        // overlapping matches repeat a pattern, the copyable distance doubles with each step
+        auto const src = out - offset;
+        for (size_t left = len; left > 0;)
+        {
+            auto const n = left < size_t(out - src) ? left : size_t(out - src);
+            std::memcpy(out, src, n);
+            out += n;
+            left -= n;
+        }
+    }
+}
+}
+
+bool detail::compress_trace_data(uint32_t const* data, size_t size, cc::vector<uint8_t>& out)
+{
+    std::vector<uint8_t> deltas;
+    deltas.reserve(size); // ~1 byte per dword is typical
+
+    uint64_t prev_loc = 0;
+    uint64_t prev_cycles = 0;
+    uint32_t prev_cpu = 0;
+
+    size_t idx = 0;
+    record r;
+    while (decode_record(data, size, idx, r))
+    {
+        put_varint(deltas, (zigzag(int64_t(r.cpu) - int64_t(prev_cpu)) << 1) | (r.is_end ? 1 : 0));
+        if (!r.is_end)
+        {
+            put_varint(deltas, zigzag(int64_t(uint64_t(r.loc) - prev_loc)));
+            prev_loc = uint64_t(r.loc);
+        }
+        put_varint(deltas, zigzag(int64_t(r.cycles - prev_cycles)));
+
+        prev_cycles = r.cycles;
+        prev_cpu = r.cpu;
+    }
+
+    if (idx != size)
+        return false; // not a sequence of complete records, cannot be reproduced exactly
+
+    put_varint(out, size);
+    put_varint(out, deltas.size());
+    lz_compress(deltas, out);
+    return true;
+}
+
+void detail::decompress_trace_data(uint8_t const* data, size_t size, cc::vector<uint32_t>& out)
+{
+    auto p = data;
+    auto const dwords = get_varint(p);
+    auto const delta_size = get_varint(p);
+
+    std::vector<uint8_t> deltas(delta_size);
+    lz_decompress(p, data + size, deltas.data());
+
+    uint64_t loc = 0;
+    uint64_t cycles = 0;
+    uint32_t cpu = 0;
+
+    auto const offset = out.size();
+    out.resize(offset + dwords);
+    auto d = out.data() + offset;
+
+    p = deltas.data();
+    auto const end = deltas.data() + deltas.size();
+    while (p < end)
+    {
+        auto const head = get_varint(p);
+        auto const is_end = (head & 1) != 0;
+        cpu = uint32_t(int64_t(cpu) + unzigzag(head >> 1));
+        if (!is_end)
+            loc += uint64_t(unzigzag(get_varint(p)));
+        cycles += uint64_t(unzigzag(get_varint(p)));
+
+        if (is_end)
+            *d++ = CTRACER_END_VALUE;
+        else
+        {
+            *d++ = uint32_t(loc);
+            *d++ = uint32_t(loc >> 32);
+        }
+        *d++ = uint32_t(cycles);
+        *d++ = uint32_t(cycles >> 32);
+        *d++ = cpu;
+    }
+}
+
+detail::retired_chunk::~retired_chunk() { add_tracked_memory(-int64_t(_compressed.size())); }
+
+size_t detail::retired_chunk::memory_bytes() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _raw.is_allocated() ? _raw.capacity() * sizeof(uint32_t) : _compressed.size();
+}
+
+size_t detail::retired_chunk::record_count() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_raw.is_allocated())
+        return _records;
+
+    size_t cnt = 0;
+    size_t idx = 0;
+    record r;
+    while (decode_record(_raw.data(), _size, idx, r))
+        ++cnt;
+    return cnt;
+}
+
+void detail::retired_chunk::append_to(cc::vector<uint32_t>& out) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_raw.is_allocated())
+    {
+        auto const offset = out.size();
+        out.resize(offset + _size);
+        std::memcpy(out.data() + offset, _raw.data(), _size * sizeof(uint32_t));
+    }
+    else
+        decompress_trace_data(_compressed.data(), _compressed.size(), out);
+}
+
+void detail::compress_retired_chunk(retired_chunk& c)
+{
+    // raw data is immutable once retired, so no lock is needed for reading
+    cc::vector<uint8_t> compressed;
+    if (!c._raw.is_allocated() || !compress_trace_data(c._raw.data(), c._size, compressed))
+        return; // already compressed or kept raw
+
+    auto const records = c.record_count();
+    add_tracked_memory(int64_t(compressed.size()));
+
+    std::lock_guard<std::mutex> lock(c._mutex);
+    c._compressed = cc::move(compressed);
+    c._records = records;
+    c._raw.free(); // back to the allocator
+}
+
+void detail::retire_chunk(std::shared_ptr<retired_chunk> c)
+{
+    auto& w = worker();
+
+    std::lock_guard<std::mutex> lock(w.mutex);
+    if (w.is_stopped)
+        return; // shutting down, stays uncompressed
+
+    w.queue.push_back(c);
+    if (!w.thread.joinable())
+        w.thread = std::thread([&w] { w.run(); });
+    w.queue_cv.notify_one();
+}
+
+bool detail::is_chunk_compression_enabled() { return _compression_enabled.load(std::memory_order_relaxed); }
+
+void ct::set_chunk_compression(bool enabled) { _compression_enabled = enabled; }
+
+void ct::flush_chunk_compression()
+{
+    auto& w = worker();
+
+    std::unique_lock<std::mutex> lock(w.mutex);
+    w.idle_cv.wait(lock, [&] { return w.queue.empty() && !w.is_busy; });
+}
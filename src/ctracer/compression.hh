@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include <clean-core/vector.hh>
+
+#include "chunk.hh"
+
+/*
+ * Compression of retired trace chunks (see ct::set_chunk_compression)
+ *
+ * Full chunks are handed to a background worker which
+ *   1. transforms the records into a byte stream of deltas (location, cycles, cpu) encoded as varints
+ *   2. compresses that stream with a small LZ77-style codec
+ * and returns the raw chunk memory to its ChunkAllocator.
+ *
+ * Typical traces shrink by 5-10x, scope::trace() transparently decompresses.
+ */
+
+namespace ct
+{
+namespace detail
+{
+/// encodes raw trace data (as written by TRACE)
+/// returns false if the data is not a sequence of complete records (it is then kept uncompressed)
+bool compress_trace_data(uint32_t const* data, size_t size, cc::vector<uint8_t>& out);
+/// appends the decoded dwords to out (must be the output of compress_trace_data)
+void decompress_trace_data(uint8_t const* data, size_t size, cc::vector<uint32_t>& out);
+
+/// a full chunk of a scope that is (or will be) compressed in the background
+struct retired_chunk
+{
+    /// uncompressed size in dwords
+    size_t size() const { return _size; }
+    /// bytes currently held (raw chunk capacity or compressed size)
+    size_t memory_bytes() const;
+    /// number of records in this chunk
+    size_t record_count() const;
+
+    /// appends the uncompressed data to out
+    void append_to(cc::vector<uint32_t>& out) const;
+
+    explicit retired_chunk(chunk c) : _raw(static_cast<chunk&&>(c)), _size(_raw.size()) {}
+    ~retired_chunk();
+
+private:
+    mutable std::mutex _mutex;
+    chunk _raw; ///< freed after compression
+    cc::vector<uint8_t> _compressed;
+    size_t _size = 0;
+    size_t _records = 0;
+
+    friend void compress_retired_chunk(retired_chunk& c);
+};
+
+/// compresses c (now if the background worker is not running)
+void compress_retired_chunk(retired_chunk& c);
+/// queues c for compression on the background worker
+void retire_chunk(std::shared_ptr<retired_chunk> c);
+/// true if full chunks should be retired (see ct::set_chunk_compression)
+bool is_chunk_compression_enabled();
+}
+}
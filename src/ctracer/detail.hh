@@ -1,20 +1,90 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
+#include <clean-core/string.hh>
+
+#include "trace.hh"
+
 namespace ct
 {
 struct scope;
 struct chunk;
+enum class print_unit;
 
 namespace detail
 {
-void push_scope(scope& s);
+/// a single decoded TRACE record
+struct record
+{
+    location const* loc; ///< nullptr for end records
+    uint64_t cycles;
+    uint32_t cpu;
+    bool is_end;
+};
+
+/// decodes the record starting at data[idx] and advances idx
+/// returns false if there are no more (complete) records
+inline bool decode_record(uint32_t const* data, size_t size, size_t& idx, record& r)
+{
+    if (idx >= size || data[idx] == 0x0)
+        return false; // rest is not done
+
+    if (data[idx] != CTRACER_END_VALUE)
+    {
+        if (idx + 5 > size)
+            return false;
+        r.loc = (location const*)(((uint64_t)data[idx + 1] << 32uLL) | data[idx]);
+        r.cycles = ((uint64_t)data[idx + 3] << 32) | data[idx + 2];
+        r.cpu = data[idx + 4];
+        r.is_end = false;
+        idx += 5;
+    }
+    else
+    {
+        if (idx + 4 > size)
+            return false;
+        r.loc = nullptr;
+        r.cycles = ((uint64_t)data[idx + 2] << 32) | data[idx + 1];
+        r.cpu = data[idx + 3];
+        r.is_end = true;
+        idx += 4;
+    }
+
+    return true;
+}
+
+void push_scope(scope& s, bool allocate_chunk);
 void pop_scope(scope& s);
+/// rewinds the write pointer of the (current) scope to its first chunk
+void reset_scope(scope& s);
 
 chunk* add_chunk(scope& s, chunk&& c);
 
+/// see ct::set_memory_budget (0 = unlimited)
+void set_chunk_memory_budget(size_t bytes);
+/// adds trace memory that is not part of a chunk (e.g. compressed chunks) to get_total_memory_consumption
+void add_tracked_memory(int64_t bytes);
+
+/// true if set_location_throttle is active
+bool is_location_throttle_enabled();
+/// counts the TRACEs of a full chunk per one-second window and disables locations that are over the throttle rate
+void throttle_hot_locations(uint32_t const* data, size_t size);
+
+/// true between ct::start_live_export and ct::stop_live_export
+bool is_live_export_active();
+/// mirrors complete records of the current thread into its ring of the live export segment
+void publish_live_records(uint32_t const* data, size_t size, cc::string const& thread_name);
+
 // sets size of current chunk correct
 void update_current_chunk_size();
 
 void mark_as_orphaned(scope& s);
+
+// output helpers shared by the different writers
+cc::string format_cycles(double cycles, double to_sec_factor, print_unit unit);
+/// user-defined name or (beautified) function name
+cc::string location_name(location const& loc);
 }
 }
@@ -0,0 +1,292 @@
+#include "diff.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <clean-core/map.hh>
+#include <clean-core/string.hh>
+#include <clean-core/vector.hh>
+
+#include "detail.hh"
+#include "histogram.hh"
+
+using namespace ct;
+
+namespace
+{
+struct location_acc
+{
+    location const* loc = nullptr;
+    int samples = 0;
+    uint64_t total_cycles = 0;
+    uint64_t self_cycles = 0;
+    double mean = 0; // Welford
+    double m2 = 0;
+    histogram hist;
+};
+
+struct stats_visitor : ct::visitor
+{
+    struct stack_entry
+    {
+        location const* loc;
+        uint64_t cycles;
+        uint64_t cycles_children;
+    };
+
+    cc::map<location const*, location_acc> stats;
+    cc::vector<stack_entry> stack;
+
+    void on_trace_start(ct::location const& loc, uint64_t cycles, uint32_t /*cpu*/) override { stack.push_back({&loc, cycles, 0}); }
+    void on_trace_end(uint64_t cycles, uint32_t /*cpu*/) override
+    {
+        auto se = stack.back();
+        stack.pop_back();
+        auto dt = cycles - se.cycles;
+
+        auto& a = stats[se.loc];
+        a.loc = se.loc;
+        a.samples++;
+        a.total_cycles += dt;
+        a.self_cycles += dt - se.cycles_children;
+        a.hist.add(dt);
+
+        auto const delta = double(dt) - a.mean;
+        a.mean += delta / a.samples;
+        a.m2 += delta * (double(dt) - a.mean);
+
+        if (!stack.empty())
+            stack.back().cycles_children += dt;
+    }
+};
+
+cc::string location_key(location const& loc)
+{
+    cc::string key = loc.file;
+    key += ':';
+    key += std::to_string(loc.line).c_str();
+    key += ':';
+    key += loc.name ? loc.name : "";
+    return key;
+}
+
+// merges an accumulator into a diff side (several locations can share the same key, e.g. template instantiations)
+void add_to_side(location_diff::side& s, location const* loc, location_acc const& a, histogram& hist)
+{
+    if (!s.loc)
+        s.loc = loc;
+
+    auto const n = s.samples + a.samples;
+    if (n > 0)
+    {
+        // parallel variance combination
+        auto const delta = a.mean - s.mean_cycles;
+        auto const m2 = s.var_cycles * (s.samples > 1 ? s.samples - 1 : 0) + a.m2 + delta * delta * double(s.samples) * a.samples / n;
+        s.mean_cycles += delta * a.samples / n;
+        s.var_cycles = n > 1 ? m2 / (n - 1) : 0.0;
+    }
+
+    s.samples = n;
+    s.total_cycles += a.total_cycles;
+    s.self_cycles += a.self_cycles;
+    hist.merge(a.hist);
+}
+
+double seconds_per_cycle(trace const& t) { return t.elapsed_cycles() > 0 ? t.elapsed_seconds() / double(t.elapsed_cycles()) : 0.0; }
+}
+
+trace_diff ct::diff(trace const& a, trace const& b, diff_config const& cfg)
+{
+    // per-pointer aggregation is cheap, string matching is only done per unique location
+    stats_visitor va;
+    stats_visitor vb;
+    visit(a, va);
+    visit(b, vb);
+
+    trace_diff res;
+    res.seconds_per_cycle_a = seconds_per_cycle(a);
+    res.seconds_per_cycle_b = seconds_per_cycle(b);
+
+    cc::map<cc::string, size_t> key_to_idx;
+    cc::vector<histogram> hists_a;
+    cc::vector<histogram> hists_b;
+
+    auto const add_stats = [&](stats_visitor const& v, bool is_a)
+    {
+        for (auto const& acc : v.stats.values())
+        {
+            auto const& loc = *acc.loc;
+            auto const key = location_key(loc);
+            if (!key_to_idx.contains_key(key))
+            {
+                key_to_idx[key] = res.locations.size();
+                auto& d = res.locations.emplace_back();
+                d.file = loc.file;
+                d.function = loc.function;
+                d.name = loc.name ? loc.name : "";
+                d.line = loc.line;
+                hists_a.emplace_back();
+                hists_b.emplace_back();
+            }
+
+            auto const idx = key_to_idx[key];
+            auto& d = res.locations[idx];
+            if (is_a)
+                add_to_side(d.a, &loc, acc, hists_a[idx]);
+            else
+                add_to_side(d.b, &loc, acc, hists_b[idx]);
+        }
+    };
+    add_stats(va, true);
+    add_stats(vb, false);
+
+    for (size_t i = 0; i < res.locations.size(); ++i)
+    {
+        auto& d = res.locations[i];
+        d.a.p50_cycles = hists_a[i].p50();
+        d.a.p90_cycles = hists_a[i].p90();
+        d.a.p99_cycles = hists_a[i].p99();
+        d.b.p50_cycles = hists_b[i].p50();
+        d.b.p90_cycles = hists_b[i].p90();
+        d.b.p99_cycles = hists_b[i].p99();
+
+        if (d.added() || d.removed())
+        {
+            d.significant = true;
+            continue;
+        }
+
+        d.relative_change = d.a.mean_cycles > 0 ? (d.b.mean_cycles - d.a.mean_cycles) / d.a.mean_cycles : 0.0;
+
+        auto const se = std::sqrt(d.a.var_cycles / d.a.samples + d.b.var_cycles / d.b.samples);
+        if (se > 0)
+            d.z = (d.b.mean_cycles - d.a.mean_cycles) / se;
+        else
+            d.z = d.b.mean_cycles == d.a.mean_cycles ? 0.0 : std::copysign(std::numeric_limits<double>::infinity(), d.b.mean_cycles - d.a.mean_cycles);
+
+        d.significant = std::abs(d.relative_change) >= cfg.min_relative_change && std::abs(d.z) >= cfg.z_threshold;
+    }
+
+    std::sort(res.locations.begin(), res.locations.end(), [](location_diff const& l, location_diff const& r) {
+        return std::abs(l.delta_total_cycles()) > std::abs(r.delta_total_cycles());
+    });
+
+    return res;
+}
+
+void trace_diff::print(int max_locs, print_unit unit) const
+{
+    using detail::format_cycles;
+
+    if (int(locations.size()) < max_locs)
+        max_locs = int(locations.size());
+
+    for (auto i = 0; i < max_locs; ++i)
+    {
+        auto const& d = locations[size_t(i)];
+
+        auto name = d.name;
+        if (name.empty())
+            name = d.a.loc ? detail::location_name(*d.a.loc) : detail::location_name(*d.b.loc);
+
+        std::cout << (d.significant ? "* " : "  ");
+        if (d.added())
+            std::cout << "[added]   ";
+        else if (d.removed())
+            std::cout << "[removed] ";
+        else
+            std::cout << (d.relative_change >= 0 ? "+" : "") << std::round(d.relative_change * 1000) / 10 << "% ";
+
+        std::cout << format_cycles(d.a.total_cycles, seconds_per_cycle_a, unit).c_str() << " -> "
+                  << format_cycles(d.b.total_cycles, seconds_per_cycle_b, unit).c_str() << " (" << d.a.samples << "x -> " << d.b.samples << "x, "
+                  << format_cycles(d.a.mean_cycles, seconds_per_cycle_a, unit).c_str() << " -> "
+                  << format_cycles(d.b.mean_cycles, seconds_per_cycle_b, unit).c_str() << " / sample, p99 "
+                  << format_cycles(d.a.p99_cycles, seconds_per_cycle_a, unit).c_str() << " -> "
+                  << format_cycles(d.b.p99_cycles, seconds_per_cycle_b, unit).c_str() << ") " << name.c_str() << std::endl;
+    }
+}
+
+void ct::write_diff_csv(trace_diff const& d, cc::string_view filename)
+{
+    std::ofstream out(cc::string(filename).c_str());
+    if (!out.good())
+        return;
+
+    out << "name,file,function,samples_a,samples_b,total_a,total_b,self_a,self_b,mean_a,mean_b,p50_a,p50_b,p90_a,p90_b,p99_a,p99_b,relative_"
+           "change,z,significant\n";
+    for (auto const& l : d.locations)
+    {
+        out << '"' << l.name.c_str() << '"' << ",";
+        out << '"' << l.file.c_str() << ":" << l.line << '"' << ",";
+        out << '"' << l.function.c_str() << '"' << ",";
+        out << l.a.samples << "," << l.b.samples << ",";
+        out << l.a.total_cycles << "," << l.b.total_cycles << ",";
+        out << l.a.self_cycles << "," << l.b.self_cycles << ",";
+        out << l.a.mean_cycles << "," << l.b.mean_cycles << ",";
+        out << l.a.p50_cycles << "," << l.b.p50_cycles << ",";
+        out << l.a.p90_cycles << "," << l.b.p90_cycles << ",";
+        out << l.a.p99_cycles << "," << l.b.p99_cycles << ",";
+        out << l.relative_change << ",";
+        out << l.z << ",";
+        out << (l.significant ? 1 : 0);
+        out << "\n";
+    }
+}
+
+void ct::write_diff_folded(trace const& a, trace const& b, cc::string_view filename)
+{
+    std::ofstream out(cc::string(filename).c_str());
+    if (!out.good())
+        return;
+
+    struct entry
+    {
+        uint64_t self_a = 0;
+        uint64_t self_b = 0;
+    };
+
+    // stacks are matched by their (string) path so that different binaries can be compared
+    cc::map<cc::string, size_t> stack_to_idx;
+    cc::vector<cc::string> stacks;
+    cc::vector<entry> entries;
+
+    auto const add_tree = [&](call_tree const& tree, bool is_a)
+    {
+        cc::vector<cc::string> paths;
+        paths.resize(tree.nodes.size());
+
+        // parents have smaller indices than children
+        for (size_t i = 1; i < tree.nodes.size(); ++i)
+        {
+            auto const& n = tree.nodes[i];
+
+            auto frame = detail::location_name(*n.loc);
+            std::replace(frame.begin(), frame.end(), ';', ',');
+
+            auto& path = paths[i];
+            if (n.parent > 0)
+            {
+                path = paths[size_t(n.parent)];
+                path += ';';
+            }
+            path += frame;
+
+            if (!stack_to_idx.contains_key(path))
+            {
+                stack_to_idx[path] = stacks.size();
+                stacks.push_back(path);
+                entries.emplace_back();
+            }
+            auto& e = entries[stack_to_idx[path]];
+            (is_a ? e.self_a : e.self_b) += n.self_cycles;
+        }
+    };
+    add_tree(a.compute_call_tree(), true);
+    add_tree(b.compute_call_tree(), false);
+
+    for (size_t i = 0; i < stacks.size(); ++i)
+        out << stacks[i].c_str() << " " << entries[i].self_a << " " << entries[i].self_b << "\n";
+}
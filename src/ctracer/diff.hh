@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+
+#include <clean-core/string.hh>
+#include <clean-core/vector.hh>
+
+#include "trace-config.hh"
+
+namespace ct
+{
+struct diff_config
+{
+    /// relative change of the per-sample mean below which a location is never flagged
+    double min_relative_change = 0.05;
+    /// minimal |z| of a Welch test on the per-sample cycles for a location to be flagged
+    double z_threshold = 3.0;
+};
+
+/// comparison of a single location in two traces
+/// locations are matched by file, line, and name (not by pointer) so traces from different binaries can be compared
+struct location_diff
+{
+    struct side
+    {
+        location const* loc = nullptr; ///< nullptr if the location does not appear in this trace
+        int samples = 0;
+        uint64_t total_cycles = 0;
+        uint64_t self_cycles = 0;
+        double mean_cycles = 0;
+        double var_cycles = 0;
+        uint64_t p50_cycles = 0;
+        uint64_t p90_cycles = 0;
+        uint64_t p99_cycles = 0;
+    };
+
+    cc::string file;
+    cc::string function;
+    cc::string name;
+    int line = 0;
+
+    side a;
+    side b;
+
+    /// (b.mean - a.mean) / a.mean
+    double relative_change = 0;
+    /// Welch test statistic of the per-sample cycles
+    double z = 0;
+    /// true if the change is both large and statistically significant (or the location was added/removed)
+    bool significant = false;
+
+    bool added() const { return a.loc == nullptr; }
+    bool removed() const { return b.loc == nullptr; }
+
+    int64_t delta_samples() const { return int64_t(b.samples) - int64_t(a.samples); }
+    int64_t delta_total_cycles() const { return int64_t(b.total_cycles) - int64_t(a.total_cycles); }
+    int64_t delta_self_cycles() const { return int64_t(b.self_cycles) - int64_t(a.self_cycles); }
+};
+
+/// result of ct::diff, locations are sorted by decreasing |delta_total_cycles|
+struct trace_diff
+{
+    cc::vector<location_diff> locations;
+
+    double seconds_per_cycle_a = 0;
+    double seconds_per_cycle_b = 0;
+
+    /// prints the max_locs locations with the largest total change
+    /// significant changes are marked with '*'
+    void print(int max_locs = 20, print_unit unit = print_unit::time) const;
+};
+
+/// compares two traces per location (e.g. before and after a change)
+/// NOTE: a is the baseline, i.e. positive deltas mean b is slower
+trace_diff diff(trace const& a, trace const& b, diff_config const& cfg = {});
+
+/// writes all locations of the diff as machine-readable csv
+void write_diff_csv(trace_diff const& d, cc::string_view filename = "diff.csv");
+
+/// writes a differential flamegraph in folded format ("frame;frame;frame self_cycles_a self_cycles_b")
+/// see https://github.com/brendangregg/FlameGraph (flamegraph.pl of this file yields the differential graph)
+void write_diff_folded(trace const& a, trace const& b, cc::string_view filename = "diff.folded");
+}
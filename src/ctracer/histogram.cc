@@ -0,0 +1,59 @@
+#include "histogram.hh"
+
+#include <cmath>
+
+using namespace ct;
+
+void histogram::merge(histogram const& rhs)
+{
+    for (auto i = 0; i < bucket_count; ++i)
+        _counts[i] += rhs._counts[i];
+    _count += rhs._count;
+    _sum += rhs._sum;
+    _min = rhs._min < _min ? rhs._min : _min;
+    _max = rhs._max > _max ? rhs._max : _max;
+}
+
+uint64_t histogram::percentile(double p) const
+{
+    if (_count == 0)
+        return 0;
+
+    auto rank = uint64_t(std::ceil(p * double(_count)));
+    if (rank < 1)
+        rank = 1;
+    if (rank > _count)
+        rank = _count;
+
+    uint64_t acc = 0;
+    for (auto i = 0; i < bucket_count; ++i)
+    {
+        acc += _counts[i];
+        if (acc >= rank)
+        {
+            auto v = bucket_upper_bound(i);
+            return v < _min ? _min : v > _max ? _max : v;
+        }
+    }
+
+    return _max;
+}
+
+uint64_t histogram::bucket_lower_bound(int bucket)
+{
+    if (bucket < sub_bucket_count)
+        return uint64_t(bucket);
+
+    auto const shift = bucket / sub_bucket_count - 1;
+    auto const sub = bucket % sub_bucket_count;
+    return uint64_t(sub_bucket_count + sub) << shift;
+}
+
+uint64_t histogram::bucket_upper_bound(int bucket)
+{
+    if (bucket < sub_bucket_count)
+        return uint64_t(bucket);
+
+    auto const shift = bucket / sub_bucket_count - 1;
+    return bucket_lower_bound(bucket) + ((uint64_t(1) << shift) - 1);
+}
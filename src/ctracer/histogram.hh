@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace ct
+{
+/**
+ * A log-linear (HDR-style) histogram of cycle counts
+ *
+ * - fixed memory (no allocations)
+ * - O(1) insertion
+ * - each power of two is split into 16 linear sub-buckets, i.e. the relative error is at most 1/16
+ * - histograms can be merged (e.g. from different threads or runs)
+ *
+ * Usage:
+ *
+ *   ct::histogram h;
+ *   h.add(cycles);
+ *   auto p99 = h.percentile(0.99);
+ */
+struct histogram
+{
+    static constexpr int sub_bucket_bits = 4;
+    static constexpr int sub_bucket_count = 1 << sub_bucket_bits;
+    static constexpr int bucket_count = (64 - sub_bucket_bits + 1) * sub_bucket_count;
+
+    void add(uint64_t value, uint64_t count = 1)
+    {
+        _counts[bucket_of(value)] += count;
+        _count += count;
+        _sum += value * count;
+        _min = value < _min ? value : _min;
+        _max = value > _max ? value : _max;
+    }
+
+    void merge(histogram const& rhs);
+    void clear() { *this = histogram(); }
+
+    bool empty() const { return _count == 0; }
+    uint64_t count() const { return _count; }
+    uint64_t sum() const { return _sum; }
+    uint64_t min() const { return _count == 0 ? 0 : _min; }
+    uint64_t max() const { return _max; }
+    double mean() const { return _count == 0 ? 0.0 : double(_sum) / double(_count); }
+
+    /// returns the (upper bound of the bucket of the) value below which a fraction p of all values lie
+    /// p is in [0, 1], e.g. 0.99 for the 99th percentile
+    /// NOTE: result is clamped to [min, max]
+    uint64_t percentile(double p) const;
+
+    uint64_t p50() const { return percentile(0.5); }
+    uint64_t p90() const { return percentile(0.9); }
+    uint64_t p99() const { return percentile(0.99); }
+    uint64_t p999() const { return percentile(0.999); }
+
+    uint64_t bucket_count_at(int bucket) const { return _counts[bucket]; }
+
+    static int bucket_of(uint64_t value)
+    {
+        if (value < sub_bucket_count)
+            return int(value);
+
+        auto const shift = highest_bit(value) - sub_bucket_bits;
+        return (shift + 1) * sub_bucket_count + int((value >> shift) & (sub_bucket_count - 1));
+    }
+    static uint64_t bucket_lower_bound(int bucket);
+    static uint64_t bucket_upper_bound(int bucket);
+
+private:
+    static int highest_bit(uint64_t v)
+    {
+#ifdef _MSC_VER
+        unsigned long idx;
+        _BitScanReverse64(&idx, v);
+        return int(idx);
+#else
+        return 63 - __builtin_clzll(v);
+#endif
+    }
+
+    uint64_t _counts[bucket_count] = {};
+    uint64_t _count = 0;
+    uint64_t _sum = 0;
+    uint64_t _min = ~uint64_t(0);
+    uint64_t _max = 0;
+};
+}
@@ -0,0 +1,279 @@
+#include "live-export.hh"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "detail.hh"
+
+using namespace ct;
+
+namespace
+{
+struct live_state
+{
+    std::mutex mutex; // serializes publishing (once per chunk or publish_live_trace)
+    std::atomic<bool> is_active = false;
+    uint64_t generation = 0; ///< invalidates thread slots of previous segments
+
+    std::string name;
+    void* base = nullptr;
+    size_t size = 0;
+    std::unordered_map<location const*, uint32_t> location_ids;
+
+    live::header* header() const { return static_cast<live::header*>(base); }
+    template <class T>
+    T* at(uint64_t offset) const
+    {
+        return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+
+    // NOTE: mutex must be locked
+    void unmap()
+    {
+#ifndef _WIN32
+        if (base)
+        {
+            munmap(base, size);
+            shm_unlink(name.c_str());
+        }
+#endif
+        base = nullptr;
+        size = 0;
+        location_ids.clear();
+        is_active = false;
+    }
+
+    ~live_state() { unmap(); }
+} _live;
+
+thread_local struct
+{
+    uint64_t generation = 0;
+    int slot = -1; ///< -1 if not registered or out of slots
+} _live_thread;
+
+uint64_t now_nanoseconds()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// NOTE: _live.mutex must be locked
+uint32_t add_string(char const* s)
+{
+    auto const h = _live.header();
+    if (s == nullptr)
+        s = "";
+
+    auto const len = std::strlen(s) + 1;
+    auto const offset = h->strings_size.load(std::memory_order_relaxed);
+    if (offset + len > h->strings_capacity)
+        return 0; // full, the table starts with ""
+
+    std::memcpy(_live.at<char>(h->strings_offset + offset), s, len);
+    h->strings_size.store(offset + len, std::memory_order_release);
+    return uint32_t(offset);
+}
+
+// NOTE: _live.mutex must be locked
+uint32_t location_id(location const* loc)
+{
+    auto it = _live.location_ids.find(loc);
+    if (it != _live.location_ids.end())
+        return it->second;
+
+    auto const h = _live.header();
+    auto const id = h->location_count.load(std::memory_order_relaxed);
+    if (id == h->max_locations)
+        return 0; // full, location 0 is "<unknown>"
+
+    auto& e = _live.at<live::location_entry>(h->locations_offset)[id];
+    e.file = add_string(loc->file);
+    e.function = add_string(loc->function);
+    e.name = add_string(loc->name);
+    e.line = loc->line;
+    e.sample_period = loc->sample_period;
+    h->location_count.store(id + 1, std::memory_order_release);
+
+    _live.location_ids[loc] = id;
+    return id;
+}
+
+// NOTE: _live.mutex must be locked
+int thread_slot(cc::string const& thread_name)
+{
+    if (_live_thread.generation == _live.generation)
+        return _live_thread.slot;
+
+    auto const h = _live.header();
+    auto const slot = h->thread_count.load(std::memory_order_relaxed);
+    _live_thread.generation = _live.generation;
+    _live_thread.slot = -1;
+    if (slot == h->max_threads)
+    {
+        std::cerr << "[ctracer] Live export: more than " << h->max_threads << " threads, " << thread_name.c_str() << " is not exported\n";
+        return -1;
+    }
+
+    auto& e = _live.at<live::thread_entry>(h->threads_offset)[slot];
+    std::strncpy(e.name, thread_name.c_str(), sizeof(e.name) - 1);
+    h->thread_count.store(slot + 1, std::memory_order_release);
+
+    _live_thread.slot = int(slot);
+    return _live_thread.slot;
+}
+}
+
+bool detail::is_live_export_active() { return _live.is_active.load(std::memory_order_relaxed); }
+
+void detail::publish_live_records(uint32_t const* data, size_t size, cc::string const& thread_name)
+{
+    std::lock_guard<std::mutex> lock(_live.mutex);
+    if (!_live.is_active)
+        return;
+
+    auto const slot = thread_slot(thread_name);
+    if (slot < 0)
+        return;
+
+    auto const h = _live.header();
+    auto& t = _live.at<live::thread_entry>(h->threads_offset)[slot];
+    auto const ring = _live.at<uint32_t>(h->rings_offset + uint64_t(slot) * h->ring_dwords * sizeof(uint32_t));
+    auto const n = h->ring_dwords;
+    auto head = t.head.load(std::memory_order_relaxed);
+
+    // readers detect overwritten data via head_reserved (records keep their size in the ring)
+    size_t dwords = 0;
+    record r;
+    while (decode_record(data, size, dwords, r))
+        continue;
+    t.head_reserved.store(head + dwords, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto const put = [&](uint32_t v) { ring[head++ % n] = v; };
+
+    uint64_t last_cycles = 0;
+    size_t idx = 0;
+    while (decode_record(data, size, idx, r))
+    {
+        if (r.is_end)
+            put(CTRACER_END_VALUE);
+        else
+        {
+            put(location_id(r.loc) + 1); // never 0 (end of data) or CTRACER_END_VALUE
+            put(0);
+        }
+        put(uint32_t(r.cycles));
+        put(uint32_t(r.cycles >> 32));
+        put(r.cpu);
+        last_cycles = r.cycles;
+    }
+
+    t.head.store(head, std::memory_order_release);
+
+    if (last_cycles > h->last_cycles.load(std::memory_order_relaxed))
+    {
+        h->last_nanoseconds.store(now_nanoseconds(), std::memory_order_relaxed);
+        h->last_cycles.store(current_cycles(), std::memory_order_relaxed);
+    }
+}
+
+bool ct::start_live_export(live_export_config const& cfg)
+{
+#ifdef _WIN32
+    (void)cfg;
+    std::cerr << "[ctracer] Live export is only supported on POSIX systems\n";
+    return false;
+#else
+    std::lock_guard<std::mutex> lock(_live.mutex);
+    _live.unmap();
+
+    if (cfg.max_threads <= 0 || cfg.max_locations <= 0 || cfg.ring_bytes_per_thread < 1024)
+    {
+        std::cerr << "[ctracer] Live export: invalid config\n";
+        return false;
+    }
+
+    auto const align = [](uint64_t s) { return (s + 63) / 64 * 64; };
+
+    live::header layout = {};
+    layout.version = live::version;
+    layout.max_threads = uint32_t(cfg.max_threads);
+    layout.max_locations = uint32_t(cfg.max_locations) + 1; // + "<unknown>"
+    layout.ring_dwords = cfg.ring_bytes_per_thread / sizeof(uint32_t);
+    layout.threads_offset = align(sizeof(live::header));
+    layout.locations_offset = align(layout.threads_offset + layout.max_threads * sizeof(live::thread_entry));
+    layout.strings_offset = align(layout.locations_offset + layout.max_locations * sizeof(live::location_entry));
+    layout.strings_capacity = cfg.string_table_bytes < 64 ? 64 : cfg.string_table_bytes;
+    layout.rings_offset = align(layout.strings_offset + layout.strings_capacity);
+    layout.segment_bytes = layout.rings_offset + layout.max_threads * layout.ring_dwords * sizeof(uint32_t);
+
+    auto const name = std::string(cfg.name.c_str());
+    auto const fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "[ctracer] Live export: could not create shared memory " << name << "\n";
+        return false;
+    }
+
+    // ftruncate zero-fills the segment
+    auto const base = ftruncate(fd, off_t(layout.segment_bytes)) == 0 //
+                          ? mmap(nullptr, layout.segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                          : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        std::cerr << "[ctracer] Live export: could not map " << layout.segment_bytes << " bytes of shared memory " << name << "\n";
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    _live.name = name;
+    _live.base = base;
+    _live.size = layout.segment_bytes;
+    ++_live.generation;
+
+    // header fields except the (zero) atomics
+    auto const h = _live.header();
+    h->version = layout.version;
+    h->segment_bytes = layout.segment_bytes;
+    h->max_threads = layout.max_threads;
+    h->max_locations = layout.max_locations;
+    h->ring_dwords = layout.ring_dwords;
+    h->threads_offset = layout.threads_offset;
+    h->locations_offset = layout.locations_offset;
+    h->strings_offset = layout.strings_offset;
+    h->strings_capacity = layout.strings_capacity;
+    h->rings_offset = layout.rings_offset;
+    h->start_nanoseconds = now_nanoseconds();
+    h->start_cycles = current_cycles();
+    h->last_nanoseconds = h->start_nanoseconds.load();
+    h->last_cycles = h->start_cycles.load();
+
+    // location 0 (fallback if the table is full)
+    static location const unknown = {"", "", "<unknown>", 0};
+    add_string("");
+    location_id(&unknown);
+
+    // readers check the magic first
+    h->magic.store(live::magic, std::memory_order_release);
+
+    _live.is_active = true;
+    return true;
+#endif
+}
+
+void ct::stop_live_export()
+{
+    std::lock_guard<std::mutex> lock(_live.mutex);
+    _live.unmap();
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <clean-core/string.hh>
+
+/*
+ * Live export of traces into a named POSIX shared-memory segment (e.g. for watching load tests)
+ *
+ * Usage:
+ *
+ *   ct::start_live_export(); // creates "/ctracer"
+ *
+ *   while (running)
+ *   {
+ *       TRACE("frame");
+ *       ...
+ *       ct::publish_live_trace(); // optional, full chunks are published automatically
+ *   }
+ *
+ * and in another process: ctracer-live /ctracer
+ *
+ * Each thread mirrors the records of its root scope into its own ring buffer in the segment
+ * (TRACEs inside a ct::scope are not exported).
+ * Location pointers are replaced by indices into a location table so that other processes can decode them.
+ *
+ * NOTE: only supported on POSIX systems
+ * NOTE: thread slots are not reused, threads beyond max_threads are not exported
+ */
+
+namespace ct
+{
+struct live_export_config
+{
+    cc::string name = "/ctracer"; ///< shm_open name
+    int max_threads = 64;
+    int max_locations = 4096;
+    size_t ring_bytes_per_thread = 4 << 20;
+    size_t string_table_bytes = 1 << 20;
+};
+
+/// creates the shared-memory segment and starts mirroring (returns false on error)
+bool start_live_export(live_export_config const& cfg = {});
+/// unmaps and unlinks the segment (attached readers keep their mapping)
+void stop_live_export();
+/// publishes the TRACEs of the current thread since the last publish (no-op if not exporting or inside a ct::scope)
+void publish_live_trace();
+
+/// layout of the shared-memory segment (shared with readers, e.g. ctracer-live)
+namespace live
+{
+constexpr uint32_t magic = 0x52544354; // "TCTR"
+constexpr uint32_t version = 2;
+
+/// begin records store (location index + 1) in their first word and 0 in the second,
+/// the rest of the record format is the same as in chunks (see trace.hh)
+struct header
+{
+    std::atomic<uint32_t> magic; ///< stored (release) after everything else is initialized
+    uint32_t version;
+    uint64_t segment_bytes;
+
+    uint32_t max_threads;
+    uint32_t max_locations;
+    uint64_t ring_dwords; ///< per thread
+
+    // byte offsets from the start of the segment
+    uint64_t threads_offset;   ///< thread_entry[max_threads]
+    uint64_t locations_offset; ///< location_entry[max_locations]
+    uint64_t strings_offset;   ///< zero-terminated strings
+    uint64_t strings_capacity;
+    uint64_t rings_offset; ///< uint32_t[max_threads][ring_dwords]
+
+    // entries are written before the counts are increased
+    std::atomic<uint32_t> thread_count;
+    std::atomic<uint32_t> location_count;
+    std::atomic<uint64_t> strings_size;
+
+    // cycles <-> time calibration (at start and at the last publish)
+    std::atomic<uint64_t> start_cycles;
+    std::atomic<uint64_t> start_nanoseconds;
+    std::atomic<uint64_t> last_cycles;
+    std::atomic<uint64_t> last_nanoseconds;
+};
+
+struct thread_entry
+{
+    char name[64];
+    /// total number of dwords written into the ring (always at a record boundary)
+    /// readers that fall more than ring_dwords behind have to skip to head
+    std::atomic<uint64_t> head;
+    /// head after the publish in progress, stored before the ring is written (seqlock style)
+    /// data copied from [pos, head) is only valid if head_reserved - pos <= ring_dwords afterwards
+    std::atomic<uint64_t> head_reserved;
+};
+
+struct location_entry
+{
+    // offsets into the string table
+    uint32_t file;
+    uint32_t function;
+    uint32_t name;
+    int32_t line;
+    uint32_t sample_period;
+};
+}
+}
@@ -0,0 +1,111 @@
+#include "perf-counters.hh"
+
+#include <atomic>
+#include <iostream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#endif
+
+using namespace ct;
+
+#ifdef __linux__
+namespace
+{
+int open_counter(uint32_t type, uint64_t config, int group_fd)
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group_fd < 0 ? 1 : 0; // only the leader starts disabled
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return int(syscall(__NR_perf_event_open, &attr, 0 /* this thread */, -1 /* any cpu */, group_fd, 0));
+}
+}
+#endif
+
+perf_counters::perf_counters(bool enable)
+{
+    if (!enable)
+        return;
+
+#ifdef __linux__
+    struct
+    {
+        uint32_t type;
+        uint64_t config;
+    } const events[counter_count] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+
+    _fds[0] = open_counter(events[0].type, events[0].config, -1);
+    if (_fds[0] < 0)
+    {
+        static std::atomic<bool> warned = false;
+        if (!warned.exchange(true))
+            std::cerr << "[ctracer] hardware counters not available (perf_event_open failed, see /proc/sys/kernel/perf_event_paranoid)" << std::endl;
+        return;
+    }
+    _group_index[0] = _group_size++;
+
+    for (auto i = 1; i < counter_count; ++i)
+    {
+        _fds[i] = open_counter(events[i].type, events[i].config, _fds[0]);
+        if (_fds[i] >= 0)
+            _group_index[i] = _group_size++;
+    }
+
+    ioctl(_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+perf_counters::~perf_counters()
+{
+#ifdef __linux__
+    // members before leader
+    for (auto i = counter_count - 1; i >= 0; --i)
+        if (_fds[i] >= 0)
+            close(_fds[i]);
+#endif
+}
+
+counter_values perf_counters::read() const
+{
+    counter_values v;
+
+#ifdef __linux__
+    if (!is_available())
+        return v;
+
+    uint64_t buffer[3 + counter_count] = {}; // nr, time_enabled, time_running, values...
+    if (::read(_fds[0], buffer, sizeof(buffer)) <= 0)
+        return v;
+
+    v.time_enabled = buffer[1];
+    v.time_running = buffer[2];
+    auto const get = [&](int i) -> uint64_t
+    { return _group_index[i] >= 0 && uint64_t(_group_index[i]) < buffer[0] ? buffer[3 + _group_index[i]] : 0; };
+    v.instructions = get(0);
+    v.cpu_cycles = get(1);
+    v.l1d_misses = get(2);
+    v.llc_misses = get(3);
+    v.branch_misses = get(4);
+#endif
+
+    return v;
+}
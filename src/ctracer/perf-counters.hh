@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+
+namespace ct
+{
+/// values of the hardware performance counters (cumulative or deltas)
+struct counter_values
+{
+    uint64_t instructions = 0;
+    uint64_t cpu_cycles = 0; ///< actual core cycles (in contrast to TSC cycles)
+    uint64_t l1d_misses = 0;
+    uint64_t llc_misses = 0;
+    uint64_t branch_misses = 0;
+
+    /// nanoseconds the group was enabled and actually counting
+    /// (less running than enabled time means the counters were multiplexed with other perf users)
+    uint64_t time_enabled = 0;
+    uint64_t time_running = 0;
+
+    /// false if the group was never scheduled, i.e. all counts are zero regardless of the measured code
+    bool is_valid() const { return time_running > 0; }
+
+    /// counts extrapolated to the whole enabled time (same values if the counters were not multiplexed)
+    /// NOTE: apply to deltas, so that the scaling only covers the measured interval
+    counter_values scaled() const
+    {
+        if (time_running == 0 || time_running >= time_enabled)
+            return *this;
+
+        auto const f = double(time_enabled) / double(time_running);
+        auto const scale = [f](uint64_t v) { return uint64_t(double(v) * f + 0.5); };
+        return {scale(instructions), scale(cpu_cycles), scale(l1d_misses), scale(llc_misses), scale(branch_misses), time_enabled, time_enabled};
+    }
+
+    counter_values operator-(counter_values const& rhs) const
+    {
+        return {instructions - rhs.instructions,   cpu_cycles - rhs.cpu_cycles,     l1d_misses - rhs.l1d_misses,    llc_misses - rhs.llc_misses,
+                branch_misses - rhs.branch_misses, time_enabled - rhs.time_enabled, time_running - rhs.time_running};
+    }
+    counter_values operator+(counter_values const& rhs) const
+    {
+        return {instructions + rhs.instructions,   cpu_cycles + rhs.cpu_cycles,     l1d_misses + rhs.l1d_misses,    llc_misses + rhs.llc_misses,
+                branch_misses + rhs.branch_misses, time_enabled + rhs.time_enabled, time_running + rhs.time_running};
+    }
+};
+
+/**
+ * A group of hardware performance counters for the calling thread (via perf_event_open)
+ *
+ * Counters are started in the constructor and run until destruction.
+ * Deltas are computed by reading before and after the measured code.
+ *
+ * Only supported on Linux. If perf is restricted (e.g. by /proc/sys/kernel/perf_event_paranoid)
+ * or unsupported, is_available() returns false and read() returns zeros.
+ * Single events that are not supported (e.g. in VMs) simply read as zero.
+ * If the kernel multiplexes the counters (more events than hardware counters), read() reports the
+ * enabled and running times, see counter_values::scaled() and counter_values::is_valid().
+ */
+class perf_counters
+{
+public:
+    explicit perf_counters(bool enable = true);
+    ~perf_counters();
+
+    bool is_available() const { return _fds[0] >= 0; }
+
+    counter_values read() const;
+
+    // owns file descriptors
+    perf_counters(perf_counters const&) = delete;
+    perf_counters& operator=(perf_counters const&) = delete;
+
+private:
+    static constexpr int counter_count = 5;
+    int _fds[counter_count] = {-1, -1, -1, -1, -1};
+    int _group_index[counter_count] = {-1, -1, -1, -1, -1}; // position in the group read
+    int _group_size = 0;
+};
+}
@@ -3,19 +3,27 @@
 #include <cstring>
 
 #include "ChunkAllocator.hh"
+#include "compression.hh"
 #include "detail.hh"
 #include "trace-container.hh"
 
 using namespace ct;
 
-scope::scope(cc::string name, std::shared_ptr<ChunkAllocator> const& allocator)
+scope::scope(cc::string name, std::shared_ptr<ChunkAllocator> const& allocator, chunk_allocation mode)
   : _name(cc::move(name)), _allocator(allocator ? allocator : ChunkAllocator::global())
 {
     // after this call all TRACE(...)s are directed into this scope
-    ct::detail::push_scope(*this);
+    ct::detail::push_scope(*this, mode == chunk_allocation::eager);
 
     _time_start = std::chrono::high_resolution_clock::now();
     _cycles_start = ct::current_cycles();
+    _alloc_start = get_thread_alloc_counters();
+}
+
+scope::scope(null_scope_tag) : scope("", nullptr, chunk_allocation::lazy)
+{
+    _is_null_scope = true;
+    ct::detail::tdata().discard = true;
 }
 
 scope::~scope()
@@ -35,19 +43,46 @@ ct::trace scope::trace() const
 
     // precompute final size
     size_t cnt = 0;
-    for (auto const& c : _chunks)
-        cnt += c.size();
+    for (auto const& r : _retired)
+        cnt += r->size();
+    for (size_t i = 0; i < _used_chunks; ++i)
+        cnt += _chunks[i].size();
 
-    // copy trace into preallocated data
+    // decompress retired chunks and copy trace into preallocated data
     cc::vector<uint32_t> data;
+    data.reserve(cnt);
+    for (auto const& r : _retired)
+        r->append_to(data);
+    size_t idx = data.size();
     data.resize(cnt);
-    size_t idx = 0;
-    for (auto const& c : _chunks)
+    for (size_t i = 0; i < _used_chunks; ++i)
     {
+        auto const& c = _chunks[i];
+        if (c.size() == 0)
+            continue;
         std::memcpy(data.data() + idx, c.data(), c.size() * sizeof(uint32_t));
         idx += c.size();
     }
 
     // return trace
-    return ct::trace(_name, move(data), _time_start, time_end, _cycles_start, cycles_end);
+    auto t = ct::trace(_name, move(data), _time_start, time_end, _cycles_start, cycles_end);
+    t._dropped_events = _dropped_events;
+    return t;
+}
+
+uint64_t scope::compressed_bytes() const
+{
+    uint64_t bytes = 0;
+    for (auto const& r : _retired)
+        bytes += r->memory_bytes();
+    return bytes;
+}
+
+void scope::reset()
+{
+    ct::detail::reset_scope(*this);
+
+    _time_start = std::chrono::high_resolution_clock::now();
+    _cycles_start = ct::current_cycles();
+    _alloc_start = get_thread_alloc_counters();
 }
@@ -6,6 +6,7 @@
 #include <clean-core/vector.hh>
 #include <clean-core/string.hh>
 
+#include "alloc-hooks.hh"
 #include "chunk.hh"
 #include "detail.hh"
 
@@ -18,6 +19,18 @@ namespace ct
 class ChunkAllocator;
 struct trace;
 
+namespace detail
+{
+struct retired_chunk;
+}
+
+/// when a scope allocates its first chunk
+enum class chunk_allocation
+{
+    eager, ///< in the constructor
+    lazy,  ///< on the first TRACE (scopes without TRACEs cause no allocator traffic)
+};
+
 /**
  * An arena for TRACE calls
  * All calls made when scope is valid are directed into its local trace and not into the global trace
@@ -31,13 +44,23 @@ struct trace;
  *   TRACE(...); // recorded into s
  *
  *   print(s.trace()); // show its trace
+ *
+ * Per-frame capture without allocator traffic after warm-up:
+ *
+ *   ct::scope s("frame", nullptr, ct::chunk_allocation::lazy);
+ *   while (running)
+ *   {
+ *       s.reset(); // keeps chunks, rewinds the write pointer
+ *       render_frame();
+ *       consume(s.trace());
+ *   }
  */
 struct scope
 {
     using time_point = std::chrono::high_resolution_clock::time_point;
 
     /// creates a new scope and optionally specifies a custom allocator
-    scope(cc::string name = "", std::shared_ptr<ChunkAllocator> const& allocator = nullptr);
+    scope(cc::string name = "", std::shared_ptr<ChunkAllocator> const& allocator = nullptr, chunk_allocation mode = chunk_allocation::eager);
     ~scope();
 
     // raii type
@@ -49,6 +72,10 @@ struct scope
     /// creates a trace object (NOTE: copies chunk data)
     ct::trace trace() const;
 
+    /// discards all recorded data but keeps the chunks for reuse
+    /// NOTE: must be the innermost scope of this thread and must not be called while TRACEs inside the scope are open
+    void reset();
+
     /// returns the trace name (either thread name or scope name)
     cc::string const& name() const { return _name; }
 
@@ -59,24 +86,51 @@ struct scope
     uint64_t alloc_warn_threshold() const { return _warn_bytes; }
 
     /// number of currently allocated bytes inside this scope, excluding nested scopes
+    /// NOTE: chunks handed to the compression worker are not included (see compressed_bytes)
     uint64_t allocated_bytes() const { return _allocated_bytes; }
 
+    /// bytes held by chunks that were handed to the compression worker (see set_chunk_compression)
+    /// NOTE: chunks that are not compressed yet count with their full size
+    uint64_t compressed_bytes() const;
+
+    /// number of TRACE events dropped or overwritten in this scope because the memory budget was exhausted (see set_memory_budget)
+    uint64_t dropped_events() const { return _dropped_events; }
+
+    /// number of heap allocations (and their bytes) of this thread since the scope was created
+    /// NOTE: requires CT_DEFINE_ALLOCATION_HOOKS() (see alloc-hooks.hh), otherwise always 0
+    /// NOTE: includes allocations of trace chunks
+    uint64_t heap_allocations() const { return get_thread_alloc_counters().allocations - _alloc_start.allocations; }
+    uint64_t heap_allocated_bytes() const { return get_thread_alloc_counters().allocated_bytes - _alloc_start.allocated_bytes; }
+
 protected:
     struct null_scope_tag
     {
     };
 
-    scope(null_scope_tag) : scope() { _is_null_scope = true; }
+    scope(null_scope_tag);
 
 private:
     cc::string _name;
     std::shared_ptr<ChunkAllocator> _allocator;
     cc::vector<chunk> _chunks;
+    size_t _used_chunks = 0; // chunks after this are kept for reuse (see reset())
+    cc::vector<std::shared_ptr<detail::retired_chunk>> _retired; // full chunks (possibly compressed), all older than _chunks
 
     time_point _time_start;
     uint64_t _cycles_start;
     uint64_t _allocated_bytes = 0;
     uint64_t _warn_bytes = 1 << 30; // 1GiB
+    uint64_t _dropped_events = 0;
+    size_t _dropped_depth = 0; // open TRACEs whose begin was dropped (see detail::alloc_trace_chunk)
+
+    // ends of recorded TRACEs that had to be dropped, written (with their original time) once memory is available again
+    struct pending_end
+    {
+        uint64_t cycles;
+        uint32_t cpu;
+    };
+    cc::vector<pending_end> _pending_ends;
+    alloc_counters _alloc_start;
 
     bool _is_null_scope = false;
     bool _orphaned = false;
@@ -84,12 +138,16 @@ private:
     // TODO: bool if orphaned scope
 
     friend uint32_t* detail::alloc_chunk();
+    friend uint32_t* detail::alloc_trace_chunk(location const* loc);
     friend void detail::mark_as_orphaned(scope& s);
     friend void detail::pop_scope(scope&);
+    friend void detail::reset_scope(scope& s);
     friend void set_thread_name(cc::string name);
     friend void set_thread_allocator(std::shared_ptr<ChunkAllocator> const& allocator);
 };
 
+/// discards all TRACEs inside (until a nested scope is created)
+/// TRACEs return after a single branch without reading the clock or writing memory
 struct null_scope : private scope
 {
     null_scope() : scope(null_scope_tag{}) {}
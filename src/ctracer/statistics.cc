@@ -0,0 +1,225 @@
+#include "statistics.hh"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace ct;
+
+namespace
+{
+// xorshift64*, good enough for resampling
+struct rng
+{
+    uint64_t state = 0x9E3779B97F4A7C15uLL;
+
+    uint64_t next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DuLL;
+    }
+};
+
+double median_inplace(double* begin, double* end)
+{
+    auto const n = size_t(end - begin);
+    if (n == 0)
+        return 0;
+
+    auto const mid = begin + n / 2;
+    std::nth_element(begin, mid, end);
+    if (n % 2 == 1)
+        return *mid;
+
+    auto const lower = *std::max_element(begin, mid);
+    return (lower + *mid) / 2;
+}
+}
+
+double ct::median(cc::vector<double> values) { return median_inplace(values.data(), values.data() + values.size()); }
+
+double ct::median_absolute_deviation(cc::vector<double> const& values, double median)
+{
+    cc::vector<double> dev;
+    dev.reserve(values.size());
+    for (auto v : values)
+        dev.push_back(std::abs(v - median));
+    return median_inplace(dev.data(), dev.data() + dev.size());
+}
+
+int ct::reject_outliers_mad(cc::vector<double>& values, double threshold)
+{
+    if (values.size() < 3)
+        return 0;
+
+    auto const med = median(values);
+    auto const mad = median_absolute_deviation(values, med);
+    if (mad <= 0)
+        return 0; // more than half of the values are identical
+
+    cc::vector<double> kept;
+    kept.reserve(values.size());
+    for (auto v : values)
+        if (0.6745 * std::abs(v - med) / mad <= threshold)
+            kept.push_back(v);
+
+    auto const removed = int(values.size() - kept.size());
+    values = cc::move(kept);
+    return removed;
+}
+
+confidence_interval ct::bootstrap_median_ci(cc::vector<double> const& values, int resamples, double confidence)
+{
+    if (values.empty())
+        return {};
+    if (values.size() == 1 || resamples < 1)
+        return {values[0], values[0]};
+
+    rng r;
+    cc::vector<double> sample;
+    sample.resize(values.size());
+    cc::vector<double> medians;
+    medians.reserve(size_t(resamples));
+
+    for (auto i = 0; i < resamples; ++i)
+    {
+        for (auto& s : sample)
+            s = values[r.next() % values.size()];
+        medians.push_back(median_inplace(sample.data(), sample.data() + sample.size()));
+    }
+
+    std::sort(medians.begin(), medians.end());
+    auto const alpha = (1 - confidence) / 2;
+    auto const lo = size_t(std::floor(alpha * (resamples - 1)));
+    auto const hi = size_t(std::ceil((1 - alpha) * (resamples - 1)));
+    return {medians[lo], medians[hi]};
+}
+
+double ct::mann_whitney_u_p_value(cc::vector<double> const& a, cc::vector<double> const& b)
+{
+    if (a.empty() || b.empty())
+        return 1;
+
+    struct entry
+    {
+        double value;
+        bool is_a;
+    };
+    cc::vector<entry> all;
+    all.reserve(a.size() + b.size());
+    for (auto v : a)
+        all.push_back({v, true});
+    for (auto v : b)
+        all.push_back({v, false});
+    std::sort(all.begin(), all.end(), [](entry const& l, entry const& r) { return l.value < r.value; });
+
+    // rank sum of a with averaged ranks for ties
+    auto const n = double(all.size());
+    auto rank_sum_a = 0.0;
+    auto tie_term = 0.0;
+    for (size_t i = 0; i < all.size();)
+    {
+        auto j = i;
+        while (j < all.size() && all[j].value == all[i].value)
+            ++j;
+
+        auto const t = double(j - i);
+        auto const avg_rank = (double(i) + double(j) + 1) / 2; // ranks are 1-based
+        for (auto k = i; k < j; ++k)
+            if (all[k].is_a)
+                rank_sum_a += avg_rank;
+        tie_term += t * t * t - t;
+
+        i = j;
+    }
+
+    auto const na = double(a.size());
+    auto const nb = double(b.size());
+    auto const u = rank_sum_a - na * (na + 1) / 2;
+    auto const mean_u = na * nb / 2;
+    auto const var_u = na * nb / 12 * ((n + 1) - tie_term / (n * (n - 1)));
+    if (var_u <= 0)
+        return 1; // all values identical
+
+    auto const z = (std::abs(u - mean_u) - 0.5) / std::sqrt(var_u); // with continuity correction
+    return std::erfc(std::max(0.0, z) / std::sqrt(2.0));
+}
+
+char const* ct::to_string(complexity c)
+{
+    switch (c)
+    {
+    case complexity::o_1:
+        return "O(1)";
+    case complexity::o_log_n:
+        return "O(log n)";
+    case complexity::o_n:
+        return "O(n)";
+    case complexity::o_n_log_n:
+        return "O(n log n)";
+    case complexity::o_n_squared:
+        return "O(n^2)";
+    }
+    return "O(?)";
+}
+
+double ct::complexity_model(complexity c, double n)
+{
+    switch (c)
+    {
+    case complexity::o_1:
+        return 1;
+    case complexity::o_log_n:
+        return std::max(1.0, std::log2(n));
+    case complexity::o_n:
+        return n;
+    case complexity::o_n_log_n:
+        return n * std::max(1.0, std::log2(n));
+    case complexity::o_n_squared:
+        return n * n;
+    }
+    return 1;
+}
+
+cc::vector<ct::complexity_fit> ct::fit_complexity(cc::vector<double> const& n, cc::vector<double> const& y)
+{
+    cc::vector<complexity_fit> fits;
+
+    for (auto model : {complexity::o_1, complexity::o_log_n, complexity::o_n, complexity::o_n_log_n, complexity::o_n_squared})
+    {
+        // minimizes sum((c * g_i - y_i)^2 / y_i^2) => c = sum(g_i / y_i) / sum(g_i^2 / y_i^2)
+        auto num = 0.0;
+        auto den = 0.0;
+        for (size_t i = 0; i < n.size() && i < y.size(); ++i)
+        {
+            if (n[i] <= 0 || y[i] <= 0)
+                continue;
+            auto const r = complexity_model(model, n[i]) / y[i];
+            num += r;
+            den += r * r;
+        }
+        if (den <= 0)
+            continue;
+
+        complexity_fit f;
+        f.model = model;
+        f.coefficient = num / den;
+
+        auto err = 0.0;
+        auto cnt = 0;
+        for (size_t i = 0; i < n.size() && i < y.size(); ++i)
+        {
+            if (n[i] <= 0 || y[i] <= 0)
+                continue;
+            auto const e = f.coefficient * complexity_model(model, n[i]) / y[i] - 1;
+            err += e * e;
+            ++cnt;
+        }
+        f.rms_error = std::sqrt(err / cnt);
+        fits.push_back(f);
+    }
+
+    std::sort(fits.begin(), fits.end(), [](complexity_fit const& a, complexity_fit const& b) { return a.rms_error < b.rms_error; });
+    return fits;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+
+#include <clean-core/vector.hh>
+
+/*
+ * Small statistics toolbox used by the benchmark engine
+ *
+ * All functions take samples by value or const-ref and never modify the input (except reject_outliers_mad).
+ */
+
+namespace ct
+{
+struct confidence_interval
+{
+    double low = 0;
+    double high = 0;
+};
+
+/// median of the values (0 if empty)
+double median(cc::vector<double> values);
+
+/// median absolute deviation around the given median (unscaled)
+double median_absolute_deviation(cc::vector<double> const& values, double median);
+
+/// removes all values with a modified z-score (0.6745 * |x - median| / MAD) above the threshold
+/// returns the number of removed values
+int reject_outliers_mad(cc::vector<double>& values, double threshold = 3.5);
+
+/// percentile bootstrap confidence interval of the median
+/// NOTE: deterministic (uses a fixed seed)
+confidence_interval bootstrap_median_ci(cc::vector<double> const& values, int resamples = 1000, double confidence = 0.95);
+
+/// two-sided p-value of the Mann-Whitney U test (normal approximation with tie correction)
+/// i.e. the probability of a rank difference at least this large if a and b came from the same distribution
+/// NOTE: returns 1 if either side has no values
+double mann_whitney_u_p_value(cc::vector<double> const& a, cc::vector<double> const& b);
+
+/// asymptotic complexity models for fit_complexity
+enum class complexity
+{
+    o_1,
+    o_log_n,
+    o_n,
+    o_n_log_n,
+    o_n_squared,
+};
+
+/// e.g. "O(n log n)"
+char const* to_string(complexity c);
+
+/// value of the model function g(n) (e.g. n * log2(n))
+double complexity_model(complexity c, double n);
+
+struct complexity_fit
+{
+    complexity model = complexity::o_1;
+    double coefficient = 0; ///< y ~ coefficient * g(n)
+    double rms_error = 0;   ///< root mean square of the relative residuals (y_fit / y - 1)
+};
+
+/// fits y ~ c * g(n) for all complexity models (least squares on the relative error, i.e. all sizes weigh equally)
+/// returns the fits sorted by rms_error (best first)
+/// NOTE: points with n <= 0 or y <= 0 are ignored
+cc::vector<complexity_fit> fit_complexity(cc::vector<double> const& n, cc::vector<double> const& y);
+}
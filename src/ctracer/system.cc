@@ -0,0 +1,153 @@
+#include "system.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+int ct::hardware_thread_count()
+{
+    auto const n = int(std::thread::hardware_concurrency());
+    return n > 0 ? n : 1;
+}
+
+bool ct::pin_current_thread(int core)
+{
+    if (core < 0)
+        return false;
+
+#if defined(_WIN32)
+    if (core >= 64)
+        return false;
+    return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core) != 0;
+#elif defined(__linux__)
+    if (core >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+int ct::current_core()
+{
+#if defined(_WIN32)
+    return int(GetCurrentProcessorNumber());
+#elif defined(__linux__)
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+cc::string ct::cpu_governor(int core)
+{
+    std::ifstream in("/sys/devices/system/cpu/cpu" + std::to_string(core) + "/cpufreq/scaling_governor");
+    std::string governor;
+    if (!(in >> governor))
+        return "";
+    return governor.c_str();
+}
+
+double ct::cpu_frequency_mhz(int core)
+{
+    std::ifstream in("/sys/devices/system/cpu/cpu" + std::to_string(core) + "/cpufreq/scaling_cur_freq");
+    double khz = 0;
+    if (!(in >> khz))
+        return 0;
+    return khz / 1000;
+}
+
+double ct::load_average()
+{
+    std::ifstream in("/proc/loadavg");
+    double load = -1;
+    if (!(in >> load))
+        return -1;
+    return load;
+}
+
+size_t ct::last_level_cache_bytes()
+{
+#if defined(_WIN32)
+    DWORD len = 0;
+    GetLogicalProcessorInformation(nullptr, &len);
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(len / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if (infos.empty() || !GetLogicalProcessorInformation(infos.data(), &len))
+        return 0;
+
+    size_t size = 0;
+    for (auto const& i : infos)
+        if (i.Relationship == RelationCache)
+            size = std::max(size, size_t(i.Cache.Size));
+    return size;
+#else
+    // sizes are reported like "32K" or "30720K"
+    size_t size = 0;
+    for (auto i = 0;; ++i)
+    {
+        std::ifstream in("/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(i) + "/size");
+        size_t value = 0;
+        if (!(in >> value))
+            break;
+        char unit = 0;
+        in >> unit;
+        if (unit == 'K')
+            value <<= 10;
+        else if (unit == 'M')
+            value <<= 20;
+        size = std::max(size, value);
+    }
+    return size;
+#endif
+}
+
+ct::scoped_thread_pin::scoped_thread_pin(int core)
+{
+#if defined(_WIN32)
+    static_assert(sizeof(DWORD_PTR) <= sizeof(_prev_affinity), "affinity buffer too small");
+    if (core < 0 || core >= 64)
+        return;
+    auto const prev = SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core);
+    std::memcpy(_prev_affinity, &prev, sizeof(prev));
+    _pinned = prev != 0;
+#elif defined(__linux__)
+    static_assert(sizeof(cpu_set_t) <= sizeof(_prev_affinity), "affinity buffer too small");
+    cpu_set_t prev;
+    if (core < 0 || pthread_getaffinity_np(pthread_self(), sizeof(prev), &prev) != 0)
+        return;
+    std::memcpy(_prev_affinity, &prev, sizeof(prev));
+    _pinned = pin_current_thread(core);
+#else
+    (void)core;
+#endif
+}
+
+ct::scoped_thread_pin::~scoped_thread_pin()
+{
+    if (!_pinned)
+        return;
+
+#if defined(_WIN32)
+    DWORD_PTR prev;
+    std::memcpy(&prev, _prev_affinity, sizeof(prev));
+    SetThreadAffinityMask(GetCurrentThread(), prev);
+#elif defined(__linux__)
+    cpu_set_t prev;
+    std::memcpy(&prev, _prev_affinity, sizeof(prev));
+    pthread_setaffinity_np(pthread_self(), sizeof(prev), &prev);
+#endif
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+
+#include <clean-core/string.hh>
+
+namespace ct
+{
+/// number of logical cores (at least 1)
+int hardware_thread_count();
+
+/// restricts the calling thread to the given logical core
+/// returns false if not supported or not possible
+bool pin_current_thread(int core);
+
+/// logical core the calling thread is currently running on (-1 if unknown)
+int current_core();
+
+/// frequency scaling governor of the given core (empty if unknown)
+cc::string cpu_governor(int core);
+
+/// current frequency of the given core in MHz (0 if unknown)
+double cpu_frequency_mhz(int core);
+
+/// system load average over the last minute (-1 if unknown)
+double load_average();
+
+/// size of the largest (last-level) cache in bytes (0 if unknown)
+size_t last_level_cache_bytes();
+
+/// pins the current thread to a core and restores the previous affinity on destruction
+struct scoped_thread_pin
+{
+    explicit scoped_thread_pin(int core);
+    ~scoped_thread_pin();
+
+    bool is_pinned() const { return _pinned; }
+
+    scoped_thread_pin(scoped_thread_pin const&) = delete;
+    scoped_thread_pin& operator=(scoped_thread_pin const&) = delete;
+
+private:
+    alignas(8) unsigned char _prev_affinity[128]; // opaque OS-specific mask
+    bool _pinned = false;
+};
+}
@@ -0,0 +1,134 @@
+#include "timeline.hh"
+
+#include <algorithm>
+
+using namespace ct;
+
+merged_timeline::merged_timeline(cc::vector<trace> const& traces)
+{
+    _cursors.resize(traces.size());
+    for (size_t i = 0; i < traces.size(); ++i)
+        _cursors[i].t = &traces[i];
+
+    rewind();
+}
+
+bool merged_timeline::is_later(int a, int b) const
+{
+    auto const ca = _cursors[size_t(a)].curr.cycles;
+    auto const cb = _cursors[size_t(b)].curr.cycles;
+    return ca != cb ? ca > cb : a > b;
+}
+
+bool merged_timeline::advance(cursor& c)
+{
+    auto const& d = c.t->_data;
+    return detail::decode_record(d.data(), d.size(), c.idx, c.curr);
+}
+
+void merged_timeline::rewind()
+{
+    auto const later = [this](int a, int b) { return is_later(a, b); };
+
+    _heap.clear();
+    for (size_t i = 0; i < _cursors.size(); ++i)
+    {
+        auto& c = _cursors[i];
+        c.idx = 0;
+        c.stack.clear();
+        if (advance(c))
+            _heap.push_back(int(i));
+    }
+    std::make_heap(_heap.begin(), _heap.end(), later);
+}
+
+bool merged_timeline::next(timeline_event& e)
+{
+    if (_heap.empty())
+        return false;
+
+    auto const later = [this](int a, int b) { return is_later(a, b); };
+
+    std::pop_heap(_heap.begin(), _heap.end(), later);
+    auto const ci = _heap.back();
+    auto& c = _cursors[size_t(ci)];
+
+    // emit current record of the cursor
+    e.cycles = c.curr.cycles;
+    e.cpu = c.curr.cpu;
+    e.enter = !c.curr.is_end;
+    e.thread = ci;
+    if (e.enter)
+    {
+        e.loc = c.curr.loc;
+        c.stack.push_back(c.curr.loc);
+    }
+    else if (!c.stack.empty())
+    {
+        e.loc = c.stack.back();
+        c.stack.pop_back();
+    }
+    else // end without start
+        e.loc = nullptr;
+
+    // refill heap
+    if (advance(c))
+        std::push_heap(_heap.begin(), _heap.end(), later);
+    else
+        _heap.pop_back();
+
+    return true;
+}
+
+cc::vector<cc::vector<location const*>> merged_timeline::active_at(uint64_t cycles)
+{
+    cc::vector<cc::vector<location const*>> stacks;
+    stacks.resize(_cursors.size());
+
+    rewind();
+
+    timeline_event e;
+    while (!_heap.empty() && _cursors[size_t(_heap.front())].curr.cycles <= cycles)
+    {
+        next(e);
+        auto& s = stacks[size_t(e.thread)];
+        if (e.enter)
+            s.push_back(e.loc);
+        else if (!s.empty())
+            s.pop_back();
+    }
+
+    rewind();
+    return stacks;
+}
+
+cc::vector<concurrency_sample> merged_timeline::compute_concurrency()
+{
+    cc::vector<concurrency_sample> samples;
+    cc::vector<int> depth;
+    depth.resize(_cursors.size());
+    auto active = 0;
+
+    rewind();
+
+    timeline_event e;
+    while (next(e))
+    {
+        auto& d = depth[size_t(e.thread)];
+        auto const was_active = d > 0;
+        d += e.enter ? 1 : d > 0 ? -1 : 0;
+        auto const is_active = d > 0;
+
+        if (was_active == is_active)
+            continue;
+
+        active += is_active ? 1 : -1;
+        if (!samples.empty() && samples.back().cycles == e.cycles)
+            samples.back().active_threads = active; // collapse simultaneous changes
+        else
+            samples.push_back({e.cycles, active});
+    }
+
+    rewind();
+    return samples;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+
+#include <clean-core/vector.hh>
+
+#include "detail.hh"
+#include "trace-container.hh"
+
+namespace ct
+{
+/// an event of a merged_timeline
+struct timeline_event
+{
+    location const* loc = nullptr; ///< location of the started or ended scope
+    uint64_t cycles = 0;
+    uint32_t cpu = 0;
+    bool enter = false;
+    int thread = 0; ///< index of the source trace
+};
+
+/// number of threads with at least one open scope, starting at the given cycle count
+struct concurrency_sample
+{
+    uint64_t cycles = 0;
+    int active_threads = 0;
+};
+
+/**
+ * A process-wide view of several (per-thread) traces
+ *
+ * Events of all traces are k-way merged by timestamp (using a heap over per-trace cursors)
+ * so no sorted copy of all events is ever materialized.
+ *
+ * Usage:
+ *
+ *   auto traces = ct::get_finished_thread_traces();
+ *   ct::merged_timeline tl(traces);
+ *
+ *   ct::timeline_event e;
+ *   while (tl.next(e))
+ *       ...
+ *
+ * NOTE: the traces are referenced, not copied, and must outlive the timeline
+ * NOTE: events with the same timestamp are ordered by thread index
+ */
+struct merged_timeline
+{
+    explicit merged_timeline(cc::vector<trace> const& traces);
+
+    int thread_count() const { return int(_cursors.size()); }
+    trace const& thread_trace(int thread) const { return *_cursors[size_t(thread)].t; }
+
+    /// returns the next event in timestamp order (false if all traces are exhausted)
+    bool next(timeline_event& e);
+
+    /// restarts iteration at the first event
+    void rewind();
+
+    /// returns for each thread the stack of open scopes at the given cycle count (outermost first)
+    /// NOTE: rewinds the timeline
+    cc::vector<cc::vector<location const*>> active_at(uint64_t cycles);
+
+    /// returns a step function of the number of threads with at least one open scope
+    /// NOTE: rewinds the timeline
+    cc::vector<concurrency_sample> compute_concurrency();
+
+private:
+    struct cursor
+    {
+        trace const* t = nullptr;
+        size_t idx = 0;
+        detail::record curr = {};
+        cc::vector<location const*> stack;
+    };
+
+    bool advance(cursor& c);
+    bool is_later(int a, int b) const;
+
+    cc::vector<cursor> _cursors;
+    cc::vector<int> _heap; // min-heap of cursor indices by (cycles, thread)
+};
+}
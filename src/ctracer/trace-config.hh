@@ -5,6 +5,7 @@
 #include <ctracer/trace.hh>
 
 #include <clean-core/string.hh>
+#include <clean-core/unique_function.hh>
 #include <clean-core/vector.hh>
 
 #include <cstdint>
@@ -34,6 +35,44 @@ struct visitor
 /// returns the total memory consumption of all traced chunks in byte
 size_t get_total_memory_consumption();
 
+/// what happens when a new chunk would exceed the memory budget
+enum class memory_budget_policy
+{
+    stop,             ///< TRACEs are dropped until memory is available again (e.g. after clear_finished_thread_traces)
+    overwrite_oldest, ///< the oldest chunks of the current scope are dropped or reused (ring buffer, keeps the most recent events)
+    aggregate,        ///< like stop, but dropped TRACEs are still counted and timed per location (see get_aggregated_location_stats)
+    callback,         ///< on_exhausted decides (it can free memory and request a retry), otherwise the TRACE is dropped
+};
+
+/// process-wide cap on chunk memory (as reported by get_total_memory_consumption)
+/// NOTE: chunks on allocator free lists count towards the budget but are still reused when exhausted
+/// NOTE: affected traces report is_incomplete() so analyses can tell that events are missing
+struct memory_budget
+{
+    size_t max_bytes = 0; ///< 0 = unlimited
+    memory_budget_policy policy = memory_budget_policy::stop;
+
+    /// (policy callback only) called on the tracing thread with the current total memory consumption
+    /// returns true if the allocation should be retried (once)
+    /// NOTE: TRACEs inside the callback are dropped
+    cc::unique_function<bool(size_t total_bytes)> on_exhausted;
+};
+
+void set_memory_budget(memory_budget budget);
+/// number of TRACE events (begins and ends) of all threads that were dropped or overwritten due to the memory budget
+/// NOTE: once a begin is dropped, all events up to its matching end are dropped as well (even if memory is available again)
+uint64_t get_dropped_event_count();
+/// merged per-location stats of all TRACEs that were dropped under memory_budget_policy::aggregate (all threads)
+/// NOTE: a dropped subtree is merged once its outermost TRACE ends
+cc::vector<location_stats> get_aggregated_location_stats();
+
+/// if enabled, full chunks are compressed by a background worker and their memory is returned to the allocator
+/// (typically 5-10x less resident trace memory for long captures, scope::trace() decompresses transparently)
+/// NOTE: affects chunks that become full after this call
+void set_chunk_compression(bool enabled);
+/// blocks until all currently retired chunks are compressed
+void flush_chunk_compression();
+
 /// sets the default chunk allocator for new threads (nullptr resets to builtin alloc)
 void set_default_allocator(std::shared_ptr<ChunkAllocator> const& allocator);
 /// sets the chunk allocator of the current thread (nullptr resets to builtin alloc)
@@ -47,14 +86,71 @@ void set_thread_alloc_warn_threshold(uint64_t bytes);
 trace get_current_thread_trace();
 /// returns a trace objects for all finished threads
 cc::vector<trace> get_finished_thread_traces();
-/// frees memory of finished threads
+/// frees memory of finished threads (including compacted stats)
 void clear_finished_thread_traces();
 
+/// what happens to the traces of finished threads
+/// (by default, all finished threads are kept until clear_finished_thread_traces)
+struct finished_thread_policy
+{
+    /// at most this many finished threads are kept, oldest are evicted first (0 = unlimited)
+    size_t max_threads = 0;
+    /// at most this many bytes of chunk memory are kept, oldest are evicted first (0 = unlimited)
+    size_t max_bytes = 0;
+    /// finished threads older than this are evicted (0 = never)
+    /// NOTE: checked whenever a thread finishes or finished traces are queried
+    double max_age_seconds = 0;
+
+    /// finished threads are merged into per-location stats (see get_compacted_thread_stats) instead of keeping their chunks
+    bool compact = false;
+
+    /// called for every finished thread on a background thread (e.g. to write it to disk)
+    /// NOTE: retention and compaction are applied afterwards
+    cc::unique_function<void(trace const&)> on_finished;
+};
+
+/// merged stats of all compacted finished threads
+struct compacted_thread_stats
+{
+    int thread_count = 0;
+    cc::vector<location_stats> locations;
+};
+
+void set_finished_thread_policy(finished_thread_policy policy);
+compacted_thread_stats get_compacted_thread_stats();
+/// blocks until all finished threads have been passed to on_finished and compacted
+void flush_finished_threads();
+
+/// runtime switches for TRACE() locations (without a rebuild)
+/// rules also apply to locations that are executed later, later rules override earlier ones
+/// file matches if it is a suffix of __FILE__ (e.g. "renderer.cc" or "src/renderer.cc")
+/// NOTE: TRACE_BEGIN/TRACE_END are not affected
+void disable_location(cc::string_view file, int line);
+void enable_location(cc::string_view file, int line);
+void disable_locations(cc::unique_function<bool(location const&)> predicate);
+void enable_locations(cc::unique_function<bool(location const&)> predicate);
+/// removes all rules and throttling, all locations are enabled again
+void enable_all_locations();
+
+/// locations with more than max_events_per_second TRACEs (summed over all threads) are disabled (0 = no throttling)
+/// NOTE: rates are counted per one-second window of the TRACE timestamps whenever a chunk is full,
+///       so a location is throttled at most one chunk late
+void set_location_throttle(uint64_t max_events_per_second);
+/// locations disabled by the throttle (in order of throttling)
+cc::vector<location const*> get_throttled_locations();
+
 /// calls visitor callbacks for each event in the trace
 void visit(trace const& t, visitor& v);
 
+/// per-TRACE overhead as seen in the recorded cycles of this machine
+/// calibrated once on first use (thread-safe), used for the compensated numbers in summaries
+tracer_overhead const& get_tracer_overhead();
+/// measures the per-TRACE overhead (in a private scope, takes well below a millisecond)
+tracer_overhead calibrate_tracer_overhead();
+
 /// writes a csv where all trace points are summarized per-location
 void write_summary_csv(cc::string_view filename);
+void write_summary_csv(trace const& t, cc::string_view filename);
 /// Json file for use with https://github.com/jlfwong/speedscope
 /// see https://github.com/jlfwong/speedscope/wiki/Importing-from-custom-sources
 void write_speedscope_json(cc::string_view filename = "speedscope.json", size_t max_events = 1'000'000);
@@ -64,6 +160,6 @@ void write_speedscope_json(trace const& t, cc::string_view filename = "speedscop
 void write_chrome_tracing_json(trace const& t, cc::string_view filename = "chrome-tracing.json", size_t max_events = 1'000'000);
 
 /// prints summary statistics of locations, sorted by time
-/// NOTE: currently misleading for recursive locations
+/// NOTE: currently misleading for recursive locations (see call_tree::compute_location_stats for a recursion-aware version)
 void print_location_stats(trace const& t, int max_locs = 10, print_unit unit = print_unit::time);
 } // namespace ct
@@ -1,7 +1,12 @@
 #include "trace-container.hh"
 
+#include <algorithm>
+#include <cstring>
+
+#include <clean-core/assert.hh>
 #include <clean-core/map.hh>
 
+#include "detail.hh"
 #include "trace-config.hh"
 
 using namespace ct;
@@ -79,23 +84,39 @@ cc::vector<location_stats> trace::compute_location_stats() const
 
         cc::vector<location const*> loc_stack;
         cc::vector<uint64_t> cycle_stack;
+        cc::vector<uint64_t> descendant_stack;
+        cc::vector<uint64_t> weight_stack;
 
         void on_trace_start(ct::location const& loc, uint64_t cycles, uint32_t /*cpu*/) override
         {
+            // recursive TRACE_SAMPLEDs are recorded together with the outermost one and share its weight
+            auto const is_recursive = loc.sample_period > 1 && std::find(loc_stack.begin(), loc_stack.end(), &loc) != loc_stack.end();
+            weight_stack.push_back((weight_stack.empty() ? 1 : weight_stack.back()) * (is_recursive ? 1 : loc.sample_period));
             loc_stack.push_back(&loc);
             cycle_stack.push_back(cycles);
+            descendant_stack.push_back(0);
         }
 
         void on_trace_end(uint64_t cycles, uint32_t /*cpu*/) override
         {
             auto loc = loc_stack.back();
+            auto descendants = descendant_stack.back();
             auto& s = stats[loc];
             s.loc = loc;
             s.samples++;
+            s.counted_samples++;
             s.total_cycles += cycles - cycle_stack.back();
+            s.descendants += descendants;
+            s.cycles_histogram.add(cycles - cycle_stack.back());
+            s.estimated_samples += weight_stack.back();
+            s.estimated_total_cycles += weight_stack.back() * (cycles - cycle_stack.back());
 
             cycle_stack.pop_back();
             loc_stack.pop_back();
+            descendant_stack.pop_back();
+            weight_stack.pop_back();
+            if (!descendant_stack.empty())
+                descendant_stack.back() += descendants + 1;
         }
     };
 
@@ -105,6 +126,164 @@ cc::vector<location_stats> trace::compute_location_stats() const
     return cc::vector<location_stats>(v.stats.values());
 }
 
+void location_stats::merge(location_stats const& rhs)
+{
+    if (!loc)
+        loc = rhs.loc;
+    samples += rhs.samples;
+    counted_samples += rhs.counted_samples;
+    total_cycles += rhs.total_cycles;
+    descendants += rhs.descendants;
+    estimated_samples += rhs.estimated_samples;
+    estimated_total_cycles += rhs.estimated_total_cycles;
+    cycles_histogram.merge(rhs.cycles_histogram);
+}
+
+uint64_t location_stats::compensated_total_cycles(tracer_overhead const& o) const
+{
+    auto const overhead = counted_samples * o.empty_cycles + descendants * o.nested_cycles;
+    return overhead < double(total_cycles) ? total_cycles - uint64_t(overhead) : 0;
+}
+
+call_tree trace::compute_call_tree() const
+{
+    struct my_visitor : ct::visitor
+    {
+        call_tree tree;
+
+        struct stack_entry
+        {
+            int node;
+            uint64_t cycles;
+            uint64_t cycles_children;
+            uint64_t descendants;
+        };
+        cc::vector<stack_entry> stack;
+
+        void on_trace_start(ct::location const& loc, uint64_t cycles, uint32_t /*cpu*/) override
+        {
+            auto parent = stack.empty() ? 0 : stack.back().node;
+            stack.push_back({tree.get_or_add_child(parent, &loc), cycles, 0, 0});
+        }
+
+        void on_trace_end(uint64_t cycles, uint32_t /*cpu*/) override
+        {
+            auto se = stack.back();
+            stack.pop_back();
+            auto dt = cycles - se.cycles;
+
+            auto& n = tree.nodes[size_t(se.node)];
+            n.samples++;
+            n.total_cycles += dt;
+            n.self_cycles += dt - se.cycles_children;
+            n.descendants += se.descendants;
+            n.min_cycles = dt < n.min_cycles ? dt : n.min_cycles;
+            n.max_cycles = dt > n.max_cycles ? dt : n.max_cycles;
+
+            if (!stack.empty())
+            {
+                stack.back().cycles_children += dt;
+                stack.back().descendants += se.descendants + 1;
+            }
+        }
+    };
+
+    my_visitor v;
+    visit(*this, v);
+
+    return cc::move(v.tree);
+}
+
+call_tree::call_tree() { nodes.emplace_back(); }
+
+int call_tree::find_child(int node, location const* loc) const
+{
+    for (auto c = nodes[size_t(node)].first_child; c >= 0; c = nodes[size_t(c)].next_sibling)
+        if (nodes[size_t(c)].loc == loc)
+            return c;
+    return -1;
+}
+
+int call_tree::get_or_add_child(int node, location const* loc)
+{
+    auto c = find_child(node, loc);
+    if (c >= 0)
+        return c;
+
+    c = int(nodes.size());
+    auto& n = nodes.emplace_back();
+    n.loc = loc;
+    n.parent = node;
+    n.depth = nodes[size_t(node)].depth + 1;
+
+    // prepend to child list
+    n.next_sibling = nodes[size_t(node)].first_child;
+    nodes[size_t(node)].first_child = c;
+
+    return c;
+}
+
+void call_tree::merge(call_tree const& rhs)
+{
+    // parents have smaller indices than children so a single forward pass suffices
+    cc::vector<int> mapped;
+    mapped.resize(rhs.nodes.size());
+    mapped[0] = 0;
+
+    for (size_t i = 1; i < rhs.nodes.size(); ++i)
+    {
+        auto const& rn = rhs.nodes[i];
+        auto idx = get_or_add_child(mapped[size_t(rn.parent)], rn.loc);
+        mapped[i] = idx;
+
+        auto& n = nodes[size_t(idx)];
+        n.samples += rn.samples;
+        n.total_cycles += rn.total_cycles;
+        n.self_cycles += rn.self_cycles;
+        n.descendants += rn.descendants;
+        n.min_cycles = rn.min_cycles < n.min_cycles ? rn.min_cycles : n.min_cycles;
+        n.max_cycles = rn.max_cycles > n.max_cycles ? rn.max_cycles : n.max_cycles;
+    }
+}
+
+cc::vector<location_stats> call_tree::compute_location_stats() const
+{
+    cc::map<location const*, location_stats> stats;
+
+    // sampling weight of each node (parents come first)
+    cc::vector<uint64_t> weights;
+    weights.resize(nodes.size());
+    weights[0] = 1;
+
+    for (size_t i = 1; i < nodes.size(); ++i)
+    {
+        auto const& n = nodes[i];
+
+        // inclusive time of recursive calls is already contained in the outermost call
+        // (and recursive TRACE_SAMPLEDs are recorded together with it, so they share its weight)
+        auto is_recursive = false;
+        for (auto p = n.parent; p > 0 && !is_recursive; p = nodes[size_t(p)].parent)
+            is_recursive = nodes[size_t(p)].loc == n.loc;
+
+        weights[i] = weights[size_t(n.parent)] * (is_recursive ? 1 : n.loc->sample_period);
+
+        auto& s = stats[n.loc];
+        s.loc = n.loc;
+        s.samples += n.samples;
+        s.estimated_samples += weights[i] * n.samples;
+
+        if (!is_recursive)
+        {
+            s.counted_samples += n.samples;
+            s.total_cycles += n.total_cycles;
+            s.estimated_total_cycles += weights[i] * n.total_cycles;
+            s.descendants += n.descendants;
+        }
+    }
+
+    return cc::vector<location_stats>(stats.values());
+}
+
 trace::trace(cc::string name, cc::vector<uint32_t> data, trace::time_point time_start, trace::time_point time_end, uint64_t cycles_start, uint64_t cycles_end)
   : _name(cc::move(name)), //
     _data(cc::move(data)),
@@ -132,11 +311,16 @@ void trace::add_end(uint64_t cycles, uint32_t cpu)
     _data.push_back(cpu);
 }
 
-void trace::add(const trace& t) { _data.push_back_range(t._data); }
+void trace::add(const trace& t)
+{
+    _data.push_back_range(t._data);
+    _dropped_events += t._dropped_events;
+}
 
 trace ct::filter_subscope(trace const& t, cc::function_ref<bool(location const&)> predicate)
 {
     auto res = trace(t.name(), {}, t.time_start(), t.time_end(), t.cycles_start(), t.cycles_end());
+    res.add_dropped_events(t.dropped_events());
 
     struct my_visitor : ct::visitor
     {
@@ -175,6 +359,7 @@ trace ct::filter_subscope(trace const& t, cc::function_ref<bool(location const&)
 trace ct::map_cpu(const trace& t, uint32_t new_cpu)
 {
     auto res = trace(t.name(), {}, t.time_start(), t.time_end(), t.cycles_start(), t.cycles_end());
+    res.add_dropped_events(t.dropped_events());
 
     struct my_visitor : ct::visitor
     {
@@ -193,3 +378,124 @@ trace ct::map_cpu(const trace& t, uint32_t new_cpu)
 
     return res;
 }
+
+trace_index ct::build_trace_index(trace const& t, size_t stride)
+{
+    CC_ASSERT(stride > 0 && "stride must be positive");
+
+    trace_index index;
+    index.stride = stride;
+
+    auto const& d = t._data;
+    cc::vector<event> stack;
+    size_t idx = 0;
+    size_t cnt = 0;
+    detail::record r;
+    while (true)
+    {
+        auto const offset = idx;
+        if (!detail::decode_record(d.data(), d.size(), idx, r))
+            break;
+
+        if (cnt++ % stride == 0)
+        {
+            index.entries.push_back({offset, r.cycles, index.open_scopes.size(), stack.size()});
+            index.open_scopes.push_back_range(stack);
+        }
+
+        if (!r.is_end)
+            stack.push_back({r.loc, r.cycles, r.cpu, true});
+        else if (!stack.empty()) // incomplete traces can contain ends whose begin was dropped
+            stack.pop_back();
+    }
+
+    return index;
+}
+
+namespace
+{
+/// position of the first record with cycles >= the given one and the scopes open before it
+struct trace_position
+{
+    size_t offset = 0;
+    cc::vector<event> open_scopes;
+};
+
+trace_position locate(cc::vector<uint32_t> const& d, trace_index const& index, uint64_t cycles)
+{
+    trace_position pos;
+
+    // last entry before the given cycles
+    auto const it = std::lower_bound(index.entries.begin(), index.entries.end(), cycles,
+                                     [](trace_index::entry const& e, uint64_t c) { return e.cycles < c; });
+    if (it != index.entries.begin())
+    {
+        auto const& e = *(it - 1);
+        pos.offset = e.offset;
+        for (auto i = e.open_begin; i < e.open_begin + e.open_count; ++i)
+            pos.open_scopes.push_back(index.open_scopes[i]);
+    }
+
+    // scan forward (at most stride records)
+    auto idx = pos.offset;
+    detail::record r;
+    while (detail::decode_record(d.data(), d.size(), idx, r) && r.cycles < cycles)
+    {
+        pos.offset = idx;
+        if (!r.is_end)
+            pos.open_scopes.push_back({r.loc, r.cycles, r.cpu, true});
+        else if (!pos.open_scopes.empty())
+            pos.open_scopes.pop_back();
+    }
+
+    return pos;
+}
+}
+
+trace ct::slice(trace const& t, trace_index const& index, uint64_t cycle_begin, uint64_t cycle_end)
+{
+    // clamp to the trace (if it has a valid range)
+    if (t.cycles_end() > t.cycles_start())
+    {
+        cycle_begin = std::max(cycle_begin, t.cycles_start());
+        cycle_end = std::min(cycle_end, t.cycles_end());
+    }
+    if (cycle_end < cycle_begin)
+        cycle_end = cycle_begin;
+
+    // interpolate wall time from the cycle range of the whole trace
+    auto const time_at = [&](uint64_t cycles)
+    {
+        if (t.elapsed_cycles() == 0)
+            return t.time_start();
+        auto const rel = (double(cycles) - double(t.cycles_start())) / double(t.elapsed_cycles());
+        return t.time_start() + std::chrono::duration_cast<trace::time_point::duration>((t.time_end() - t.time_start()) * rel);
+    };
+
+    auto res = trace(t.name(), {}, time_at(cycle_begin), time_at(cycle_end), cycle_begin, cycle_end);
+    res.add_dropped_events(t.dropped_events());
+
+    auto const& d = t._data;
+    auto const begin = locate(d, index, cycle_begin);
+    auto const end = locate(d, index, cycle_end);
+
+    // re-open enclosing scopes
+    for (auto const& e : begin.open_scopes)
+        res.add_start(*e.loc, cycle_begin, e.cpu);
+
+    // bulk copy of the window
+    auto const offset = res._data.size();
+    if (end.offset > begin.offset)
+    {
+        res._data.resize(offset + (end.offset - begin.offset));
+        std::memcpy(res._data.data() + offset, d.data() + begin.offset, (end.offset - begin.offset) * sizeof(uint32_t));
+    }
+
+    // close scopes that are still open
+    for (auto i = end.open_scopes.size(); i > 0; --i)
+        res.add_end(cycle_end, end.open_scopes[i - 1].cpu);
+
+    return res;
+}
+
+trace ct::slice(trace const& t, uint64_t cycle_begin, uint64_t cycle_end) { return slice(t, build_trace_index(t), cycle_begin, cycle_end); }
@@ -2,15 +2,20 @@
 
 #include <chrono>
 #include <cstdint>
+#include <limits>
 
 #include <clean-core/function_ref.hh>
 #include <clean-core/string.hh>
 #include <clean-core/vector.hh>
 
+#include "histogram.hh"
+
 namespace ct
 {
 struct visitor;
 struct location;
+struct trace;
+struct trace_index;
 
 struct event
 {
@@ -31,11 +36,89 @@ struct event_scope
     uint64_t cycles() const { return end_cycles - start_cycles; }
 };
 
+/// cost of TRACE as it shows up in the recorded cycles (see get_tracer_overhead in trace-config.hh)
+struct tracer_overhead
+{
+    double empty_cycles = 0;  ///< recorded duration of an empty TRACE
+    double nested_cycles = 0; ///< increase of the parent's recorded duration per nested TRACE
+};
+
 struct location_stats
 {
     location const* loc = nullptr;
     int samples = 0;
     uint64_t total_cycles = 0;
+
+    /// number of samples whose time is part of total_cycles
+    /// (same as samples, except for call_tree stats where only the outermost calls of recursive locations are counted)
+    int counted_samples = 0;
+
+    /// number of TRACEs nested inside all counted samples (at any depth)
+    uint64_t descendants = 0;
+
+    /// samples and total_cycles scaled by the sampling weight (product of the sample periods of this and all enclosing TRACE_SAMPLEDs)
+    /// recursive executions of a TRACE_SAMPLED are recorded together with the outermost one, its period counts only once
+    /// same as samples and total_cycles if nothing was sampled
+    uint64_t estimated_samples = 0;
+    uint64_t estimated_total_cycles = 0;
+
+    /// total_cycles without the estimated tracer overhead of the counted samples themselves and their descendants
+    uint64_t compensated_total_cycles(tracer_overhead const& o) const;
+
+    /// distribution of per-sample cycles
+    /// NOTE: empty for stats computed from a call_tree
+    histogram cycles_histogram;
+
+    uint64_t p50_cycles() const { return cycles_histogram.p50(); }
+    uint64_t p90_cycles() const { return cycles_histogram.p90(); }
+    uint64_t p99_cycles() const { return cycles_histogram.p99(); }
+    uint64_t p999_cycles() const { return cycles_histogram.p999(); }
+
+    /// adds the samples of another stats object (e.g. of the same location in a different thread)
+    void merge(location_stats const& rhs);
+};
+
+/// a node in a calling-context tree
+/// each node represents a unique path of locations from the root
+/// (recursive calls therefore create new, deeper nodes)
+struct call_tree_node
+{
+    location const* loc = nullptr; ///< nullptr for the root node
+    int parent = -1;
+    int first_child = -1;
+    int next_sibling = -1;
+    int depth = 0;
+
+    int samples = 0;
+    uint64_t total_cycles = 0; ///< inclusive, i.e. including children
+    uint64_t self_cycles = 0;  ///< exclusive, i.e. without children
+    uint64_t descendants = 0;  ///< number of nested TRACEs (at any depth) over all samples
+    uint64_t min_cycles = std::numeric_limits<uint64_t>::max();
+    uint64_t max_cycles = 0;
+};
+
+/// A calling-context tree stored as a flat array
+/// nodes[0] is the (location-less) root, parents always have smaller indices than their children
+struct call_tree
+{
+    cc::vector<call_tree_node> nodes;
+
+    call_tree();
+
+    call_tree_node const& root() const { return nodes[0]; }
+
+    /// returns the child of the given node with the given location (or -1 if none)
+    int find_child(int node, location const* loc) const;
+    /// returns the child of the given node with the given location and adds it if not existing
+    int get_or_add_child(int node, location const* loc);
+
+    /// adds the samples of another tree to this one (e.g. to merge trees from different threads)
+    /// NOTE: runs in O(rhs.nodes.size() * avg. children)
+    void merge(call_tree const& rhs);
+
+    /// aggregates the tree per location
+    /// NOTE: in contrast to trace::compute_location_stats, recursive locations do not count their inclusive time multiple times
+    cc::vector<location_stats> compute_location_stats() const;
 };
 
 /// An opaque value type representing a hierarchical call trace of TRACEs.
@@ -54,6 +137,9 @@ public:
     cc::vector<event_scope> compute_event_scopes() const;
     /// convenience function that visits this trace and computes per-location stats
     cc::vector<location_stats> compute_location_stats() const;
+    /// convenience function that visits this trace and computes its calling-context tree
+    /// NOTE: unfinished scopes are not counted
+    call_tree compute_call_tree() const;
 
     time_point time_start() const { return _time_start; }
     time_point time_end() const { return _time_end; }
@@ -64,6 +150,11 @@ public:
 
     bool empty() const { return _data.empty(); }
 
+    /// number of events that were not recorded because the memory budget was exhausted (see set_memory_budget)
+    /// NOTE: an incomplete trace might contain unfinished scopes and ends without begin (visit skips the latter)
+    uint64_t dropped_events() const { return _dropped_events; }
+    bool is_incomplete() const { return _dropped_events > 0; }
+
     // builder
 public:
     trace() = default;
@@ -73,6 +164,7 @@ public:
     void add_end(uint64_t cycles, uint32_t cpu);
 
     void add(trace const& t);
+    void add_dropped_events(uint64_t count) { _dropped_events += count; }
 
 private:
     cc::string _name;
@@ -85,10 +177,45 @@ private:
     uint64_t _cycles_start;
     uint64_t _cycles_end;
 
+    uint64_t _dropped_events = 0;
+
     friend struct scope;
+    friend struct merged_timeline;
     friend void visit(trace const& t, visitor& v);
+    friend trace_index build_trace_index(trace const& t, size_t stride);
+    friend trace slice(trace const& t, trace_index const& index, uint64_t cycle_begin, uint64_t cycle_end);
 };
 
+/// sparse index of a trace for time-window queries (see slice)
+/// every stride-th record gets an entry with its position and the scopes that are open before it
+/// NOTE: assumes that cycles are non-decreasing within the trace (true for traces of a single thread)
+struct trace_index
+{
+    struct entry
+    {
+        size_t offset = 0;       ///< position of the record in the trace data
+        uint64_t cycles = 0;     ///< cycles of the record
+        size_t open_begin = 0;   ///< open scopes before the record are open_scopes[open_begin, open_begin + open_count)
+        size_t open_count = 0;
+    };
+
+    cc::vector<entry> entries;
+    cc::vector<event> open_scopes; ///< begin events of the open scopes (outermost first)
+    size_t stride = 0;
+};
+
+/// builds the index in a single pass over t
+trace_index build_trace_index(trace const& t, size_t stride = 1024);
+
+/// returns the part of the trace with cycle_begin <= cycles < cycle_end
+/// scopes that are open at cycle_begin are re-opened at cycle_begin, scopes still open at cycle_end are closed at cycle_end
+/// finds the window in O(log n + stride) and copies its records in bulk
+/// NOTE: index must have been built for t
+/// NOTE: the window is clamped to cycles_start/end of t, the result uses it as its cycles_start/end (time_start/end are interpolated)
+trace slice(trace const& t, trace_index const& index, uint64_t cycle_begin, uint64_t cycle_end);
+/// same as above but builds a temporary index (i.e. O(n), build an index for repeated slicing)
+trace slice(trace const& t, uint64_t cycle_begin, uint64_t cycle_end);
+
 /// returns a filtered version of the given trace
 /// the new trace only contains samples where predicate was true for the sample or any parent
 /// (e.g. useful to restrict to subscopes)
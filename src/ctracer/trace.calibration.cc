@@ -0,0 +1,74 @@
+#include <ctracer/trace-config.hh>
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "ChunkAllocator.hh"
+#include "scope.hh"
+
+namespace ct
+{
+tracer_overhead calibrate_tracer_overhead()
+{
+    auto constexpr nested_cnt = 256;
+    auto constexpr repetitions = 21;
+
+    // large enough chunks so that no rollover happens during calibration
+    auto const allocator = ChunkAllocator::create((repetitions + 1) * (nested_cnt + 1) * CTRACER_TRACE_SIZE + 1024);
+
+    trace t;
+    {
+        ct::scope s("ctracer calibration", allocator);
+        for (auto r = 0; r < repetitions + 1; ++r) // first one is warm-up
+        {
+            TRACE("calibration outer");
+            for (auto i = 0; i < nested_cnt; ++i)
+            {
+                TRACE("calibration nested");
+            }
+        }
+        t = s.trace();
+    }
+
+    struct calibration_visitor : visitor
+    {
+        std::vector<uint64_t> starts;
+        std::vector<double> outer;
+        std::vector<double> nested;
+
+        void on_trace_start(location const&, uint64_t cycles, uint32_t) override { starts.push_back(cycles); }
+        void on_trace_end(uint64_t cycles, uint32_t) override
+        {
+            (starts.size() == 1 ? outer : nested).push_back(double(cycles - starts.back()));
+            starts.pop_back();
+        }
+    };
+    calibration_visitor v;
+    visit(t, v);
+
+    auto const median = [](std::vector<double>& values) -> double
+    {
+        if (values.empty())
+            return 0;
+        std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+        return values[values.size() / 2];
+    };
+
+    if (!v.outer.empty())
+        v.outer.erase(v.outer.begin()); // warm-up
+
+    tracer_overhead o;
+    o.empty_cycles = median(v.nested);
+    o.nested_cycles = std::max(o.empty_cycles, (median(v.outer) - o.empty_cycles) / nested_cnt);
+    return o;
+}
+
+tracer_overhead const& get_tracer_overhead()
+{
+    static std::once_flag flag;
+    static tracer_overhead overhead;
+    std::call_once(flag, [] { overhead = calibrate_tracer_overhead(); });
+    return overhead;
+}
+}
@@ -2,14 +2,21 @@
 
 #include "ChunkAllocator.hh"
 #include "chunk.hh"
+#include "compression.hh"
 #include "detail.hh"
+#include "live-export.hh"
 #include "scope.hh"
 #include "trace-container.hh"
 
 #include <clean-core/assert.hh>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <sstream>
@@ -20,11 +27,136 @@ using namespace ct;
 
 namespace
 {
-struct
+using wall_clock = std::chrono::steady_clock;
+
+struct finished_thread
+{
+    std::unique_ptr<scope> root_scope;
+    wall_clock::time_point time;
+    size_t bytes = 0;
+};
+
+struct global_state
 {
     std::mutex mutex;
     std::shared_ptr<ChunkAllocator> allocator;
-    cc::vector<std::unique_ptr<scope>> finished_threads;
+
+    std::shared_ptr<cc::unique_function<bool(size_t)>> on_exhausted; // callers keep it alive, it runs without lock (and might replace it)
+    std::atomic<memory_budget_policy> budget_policy{memory_budget_policy::stop}; // readable without the mutex
+    std::atomic<uint64_t> dropped_events{0};
+    std::map<location const*, location_stats> aggregated_stats; // memory_budget_policy::aggregate
+
+    finished_thread_policy policy; // without on_finished
+    std::shared_ptr<cc::unique_function<void(trace const&)>> on_finished; // shared with the worker, callback runs without lock
+    std::deque<finished_thread> finished_threads; // oldest first
+    size_t finished_bytes = 0;
+
+    std::map<location const*, location_stats> compacted_stats;
+    int compacted_threads = 0;
+
+    // background processing of finished threads (on_finished and compaction)
+    std::deque<finished_thread> pending;
+    std::thread worker;
+    std::condition_variable pending_cv;
+    std::condition_variable idle_cv;
+    bool is_processing = false;
+    bool stop_worker = false;
+
+    ~global_state()
+    {
+        if (worker.joinable())
+        {
+            mutex.lock();
+            stop_worker = true;
+            mutex.unlock();
+            pending_cv.notify_all();
+            worker.join();
+        }
+    }
+
+    // NOTE: mutex must be locked
+    void apply_retention()
+    {
+        auto const now = wall_clock::now();
+        while (!finished_threads.empty())
+        {
+            auto const& oldest = finished_threads.front();
+            auto const too_many = policy.max_threads > 0 && finished_threads.size() > policy.max_threads;
+            auto const too_large = policy.max_bytes > 0 && finished_bytes > policy.max_bytes;
+            auto const too_old = policy.max_age_seconds > 0 && std::chrono::duration<double>(now - oldest.time).count() > policy.max_age_seconds;
+            if (!too_many && !too_large && !too_old)
+                break;
+
+            finished_bytes -= oldest.bytes;
+            finished_threads.pop_front();
+        }
+    }
+
+    // NOTE: mutex must be locked
+    void add_finished(std::unique_ptr<scope> s)
+    {
+        finished_thread t;
+        t.bytes = s->allocated_bytes() + s->compressed_bytes();
+        t.time = wall_clock::now();
+        t.root_scope = std::move(s);
+
+        if (on_finished || policy.compact)
+        {
+            pending.push_back(std::move(t));
+            if (!worker.joinable())
+                worker = std::thread([this] { process_pending(); });
+            pending_cv.notify_one();
+            return;
+        }
+
+        finished_bytes += t.bytes;
+        finished_threads.push_back(std::move(t));
+        apply_retention();
+    }
+
+    void process_pending()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            pending_cv.wait(lock, [&] { return stop_worker || !pending.empty(); });
+            if (pending.empty())
+                return;
+
+            auto t = std::move(pending.front());
+            pending.pop_front();
+            auto const compact = policy.compact;
+            auto const callback = on_finished;
+            is_processing = true;
+            lock.unlock();
+
+            auto const tr = t.root_scope->trace();
+            if (callback)
+                (*callback)(tr);
+            cc::vector<location_stats> stats;
+            if (compact)
+            {
+                stats = tr.compute_location_stats();
+                t.root_scope.reset(); // frees chunks
+            }
+
+            lock.lock();
+            if (compact)
+            {
+                for (auto const& ls : stats)
+                    compacted_stats[ls.loc].merge(ls);
+                compacted_threads++;
+            }
+            else
+            {
+                finished_bytes += t.bytes;
+                finished_threads.push_back(std::move(t));
+                apply_retention();
+            }
+            is_processing = false;
+            idle_cv.notify_all();
+        }
+    }
 } _global;
 
 thread_local struct thread_info
@@ -35,6 +167,24 @@ thread_local struct thread_info
     cc::vector<detail::thread_data> tdata_stack;
     scope* current_scope = nullptr;
     chunk* current_chunk = nullptr;
+    bool in_budget_callback = false;
+
+    // memory_budget_policy::aggregate: open TRACEs of dropped subtrees and their stats (merged into _global when the subtree ends)
+    struct aggregated_trace
+    {
+        scope* s;
+        size_t depth; ///< scope::_dropped_depth including this TRACE
+        location const* loc;
+        uint64_t cycles;
+        uint64_t weight;
+        uint64_t descendants;
+    };
+    cc::vector<aggregated_trace> aggregate_stack;
+    std::map<location const*, location_stats> aggregated_stats;
+
+    // live export: part of the current root chunk that is already published
+    uint32_t const* live_data = nullptr;
+    size_t live_published = 0;
 
     ~thread_info()
     {
@@ -43,16 +193,40 @@ thread_local struct thread_info
             CC_ASSERT(scope_stack.size() == 1 && "only root scope should be alive");
             CC_ASSERT(tdata_stack.size() == 1 && "only root scope should be alive");
 
+            // make sure the last chunk is part of the trace
+            detail::update_current_chunk_size();
+            ct::publish_live_trace();
+
             // make sure it's dtor is not called
             detail::mark_as_orphaned(*root_scope);
 
             _global.mutex.lock();
-            _global.finished_threads.emplace_back(std::move(root_scope));
+            _global.add_finished(std::move(root_scope));
             _global.mutex.unlock();
         }
     }
 } _thread;
 
+/// mirrors the unpublished part of a chunk of the root scope
+void publish_live(chunk const& c)
+{
+    auto const from = _thread.live_data == c.data() ? _thread.live_published : 0;
+    if (c.size() > from)
+        detail::publish_live_records(c.data() + from, c.size() - from, _thread.root_scope->name());
+    _thread.live_data = c.data();
+    _thread.live_published = c.size();
+}
+
+size_t count_records(chunk const& c)
+{
+    size_t cnt = 0;
+    size_t idx = 0;
+    detail::record r;
+    while (detail::decode_record(c.data(), c.size(), idx, r))
+        ++cnt;
+    return cnt;
+}
+
 void init_thread()
 {
     if (_thread.is_initialized)
@@ -79,7 +253,7 @@ void detail::mark_as_orphaned(scope& s)
     s._orphaned = true;
 }
 
-void detail::push_scope(scope& s)
+void detail::push_scope(scope& s, bool allocate_chunk)
 {
     init_thread();
 
@@ -87,9 +261,13 @@ void detail::push_scope(scope& s)
     _thread.current_scope = &s;
 
     // allocate chunk into current scope and change tdata()
+    // (or let the first TRACE allocate it)
+    // NOTE: discard is never inherited (e.g. from a null_scope or a skipped TRACE_SAMPLED), only scope(null_scope_tag) sets it
     _thread.tdata_stack.push_back(tdata());
     _thread.current_chunk = nullptr;
-    alloc_chunk();
+    tdata() = {nullptr, nullptr, false};
+    if (allocate_chunk)
+        alloc_chunk();
 }
 void detail::pop_scope(scope& s)
 {
@@ -106,8 +284,24 @@ void detail::pop_scope(scope& s)
     tdata() = _thread.tdata_stack.back();
     _thread.tdata_stack.pop_back();
 
-    // set current chunk
-    _thread.current_chunk = &_thread.current_scope->_chunks.back();
+    // set current chunk (lazy scopes might not have one yet, scopes over the memory budget might not write into it)
+    auto& parent = *_thread.current_scope;
+    _thread.current_chunk = parent._used_chunks > 0 && tdata().curr != nullptr ? &parent._chunks[parent._used_chunks - 1] : nullptr;
+}
+void detail::reset_scope(scope& s)
+{
+    CC_ASSERT(_thread.current_scope == &s && "only the innermost scope can be reset");
+
+    for (auto& c : s._chunks)
+        c._size = 0;
+    s._used_chunks = 0;
+    s._retired.clear();
+    s._pending_ends.clear();
+    s._dropped_events = 0;
+    _thread.current_chunk = nullptr;
+
+    // next TRACE picks up the first kept chunk (or is discarded)
+    tdata() = {nullptr, nullptr, s.is_null_scope()};
 }
 void detail::update_current_chunk_size()
 {
@@ -157,8 +351,9 @@ cc::vector<trace> get_finished_thread_traces()
 {
     cc::vector<trace> traces;
     _global.mutex.lock();
-    for (auto const& s : _global.finished_threads)
-        traces.emplace_back(s->trace());
+    _global.apply_retention();
+    for (auto const& t : _global.finished_threads)
+        traces.emplace_back(t.root_scope->trace());
     _global.mutex.unlock();
     return traces;
 }
@@ -167,32 +362,203 @@ void clear_finished_thread_traces()
 {
     _global.mutex.lock();
     _global.finished_threads.clear();
+    _global.finished_bytes = 0;
+    _global.compacted_stats.clear();
+    _global.compacted_threads = 0;
+    _global.mutex.unlock();
+}
+
+void set_finished_thread_policy(finished_thread_policy policy)
+{
+    std::shared_ptr<cc::unique_function<void(trace const&)>> on_finished;
+    if (policy.on_finished)
+        on_finished = std::make_shared<cc::unique_function<void(trace const&)>>(cc::move(policy.on_finished));
+
+    _global.mutex.lock();
+    _global.on_finished = std::move(on_finished); // the old callback might still run on the worker (kept alive by its copy)
+    _global.policy = std::move(policy);
+    _global.apply_retention();
+    _global.mutex.unlock();
+}
+
+compacted_thread_stats get_compacted_thread_stats()
+{
+    compacted_thread_stats stats;
+    _global.mutex.lock();
+    stats.thread_count = _global.compacted_threads;
+    for (auto const& kvp : _global.compacted_stats)
+        stats.locations.push_back(kvp.second);
     _global.mutex.unlock();
+    return stats;
+}
+
+void set_memory_budget(memory_budget budget)
+{
+    std::shared_ptr<cc::unique_function<bool(size_t)>> on_exhausted;
+    if (budget.on_exhausted)
+        on_exhausted = std::make_shared<cc::unique_function<bool(size_t)>>(cc::move(budget.on_exhausted));
+
+    _global.mutex.lock();
+    detail::set_chunk_memory_budget(budget.max_bytes);
+    _global.budget_policy = budget.policy;
+    _global.on_exhausted = std::move(on_exhausted);
+    _global.mutex.unlock();
+}
+
+uint64_t get_dropped_event_count() { return _global.dropped_events.load(); }
+
+cc::vector<location_stats> get_aggregated_location_stats()
+{
+    cc::vector<location_stats> stats;
+    _global.mutex.lock();
+    for (auto const& kvp : _global.aggregated_stats)
+        stats.push_back(kvp.second);
+    _global.mutex.unlock();
+    return stats;
+}
+
+void flush_finished_threads()
+{
+    std::unique_lock<std::mutex> lock(_global.mutex);
+    _global.idle_cv.wait(lock, [] { return _global.pending.empty() && !_global.is_processing; });
+}
+
+void publish_live_trace()
+{
+    // records of nested scopes are not exported
+    if (_thread.current_chunk == nullptr || _thread.current_scope != _thread.root_scope.get() || !detail::is_live_export_active())
+        return;
+
+    detail::update_current_chunk_size();
+    publish_live(*_thread.current_chunk);
 }
 
 uint32_t* detail::alloc_chunk()
 {
-    // new thread: register it
-    init_thread();
+    // new thread: register it (this already allocates the first chunk of the root scope)
+    if (!_thread.is_initialized)
+    {
+        init_thread();
+        return tdata().curr;
+    }
 
     // ensure previous chunk has correct size
     update_current_chunk_size();
 
+    // the finished chunk is the only place where per-location rates are counted (keeps TRACE free of counters)
+    if (_thread.current_chunk != nullptr && detail::is_location_throttle_enabled())
+        detail::throttle_hot_locations(_thread.current_chunk->data(), _thread.current_chunk->size());
+
+    // full root chunks are mirrored into the live export segment (the chunk might be reused, so start over afterwards)
+    if (_thread.current_chunk != nullptr && _thread.current_scope == _thread.root_scope.get() && detail::is_live_export_active())
+    {
+        publish_live(*_thread.current_chunk);
+        _thread.live_data = nullptr;
+    }
+
     // allocate and register chunk
     auto& s = *_thread.current_scope;
 
-    chunk* c;
-    if (!s.is_null_scope() || s._chunks.empty())
+    // hand full chunks to the compression worker (only chunks kept by reset() remain)
+    if (_thread.current_chunk != nullptr && detail::is_chunk_compression_enabled())
     {
-        s._chunks.emplace_back(s._allocator->allocate());
-        c = &s._chunks.back();
-        s._allocated_bytes += c->capacity();
+        cc::vector<chunk> kept;
+        for (size_t i = 0; i < s._chunks.size(); ++i)
+        {
+            auto& c = s._chunks[i];
+            if (i >= s._used_chunks || c.size() == 0)
+            {
+                kept.push_back(cc::move(c));
+                continue;
+            }
+
+            s._allocated_bytes -= c.capacity() * sizeof(uint32_t);
+            auto r = std::make_shared<detail::retired_chunk>(cc::move(c));
+            s._retired.push_back(r);
+            detail::retire_chunk(cc::move(r));
+        }
+        s._chunks = cc::move(kept);
+        s._used_chunks = 0;
+        _thread.current_chunk = nullptr;
+    }
+
+    auto& td = tdata();
+
+    chunk* c = nullptr;
+    if (s._used_chunks < s._chunks.size())
+    {
+        // reuse chunk kept by scope::reset()
+        c = &s._chunks[s._used_chunks++];
+    }
+    else if (auto new_chunk = s._allocator->try_allocate(); new_chunk.is_allocated())
+    {
+        c = &s._chunks.emplace_back(cc::move(new_chunk));
+        s._used_chunks++;
+        s._allocated_bytes += c->capacity() * sizeof(uint32_t);
         if (s.alloc_warn_threshold() < s.allocated_bytes())
             std::cerr << "[ctracer] Scope allocates more than " << s.alloc_warn_threshold() << " bytes!\n";
     }
-    else
+    else // memory budget exhausted
     {
-        c = &s._chunks.back();
+        // nothing is written until a chunk is available (also protects TRACEs inside the callback)
+        _thread.current_chunk = nullptr;
+        td = {nullptr, nullptr, false};
+
+        auto const policy = _global.budget_policy.load();
+        if (policy == memory_budget_policy::overwrite_oldest)
+        {
+            // drop the oldest retired chunks, their memory becomes available once the worker is done with them
+            // (a compressed chunk frees much less than a new chunk needs, so it usually takes several)
+            while (c == nullptr && !s._retired.empty())
+            {
+                auto const dropped = s._retired[0]->record_count();
+                s._dropped_events += dropped;
+                _global.dropped_events += dropped;
+                std::rotate(s._retired.begin(), s._retired.begin() + 1, s._retired.end());
+                s._retired.pop_back();
+
+                if (auto retry_chunk = s._allocator->try_allocate(); retry_chunk.is_allocated())
+                {
+                    c = &s._chunks.emplace_back(cc::move(retry_chunk));
+                    s._used_chunks++;
+                    s._allocated_bytes += c->capacity() * sizeof(uint32_t);
+                }
+            }
+
+            if (c == nullptr && s._used_chunks > 0)
+            {
+                // ring buffer: the oldest chunk becomes the newest one
+                auto const dropped = count_records(s._chunks[0]);
+                s._dropped_events += dropped;
+                _global.dropped_events += dropped;
+                std::rotate(s._chunks.begin(), s._chunks.begin() + 1, s._chunks.begin() + s._used_chunks);
+                c = &s._chunks[s._used_chunks - 1];
+            }
+        }
+        else if (policy == memory_budget_policy::callback && !_thread.in_budget_callback)
+        {
+            _global.mutex.lock();
+            auto const on_exhausted = _global.on_exhausted;
+            _global.mutex.unlock();
+
+            _thread.in_budget_callback = true;
+            if (on_exhausted && (*on_exhausted)(get_total_memory_consumption()))
+                if (auto retry_chunk = s._allocator->try_allocate(); retry_chunk.is_allocated())
+                {
+                    c = &s._chunks.emplace_back(cc::move(retry_chunk));
+                    s._used_chunks++;
+                    s._allocated_bytes += c->capacity() * sizeof(uint32_t);
+                }
+            _thread.in_budget_callback = false;
+        }
+
+        if (c == nullptr)
+        {
+            // drop this event, the next TRACE tries again
+            s._dropped_events++;
+            _global.dropped_events++;
+            return nullptr;
+        }
     }
 
     CC_ASSERT(c->data() && "invalid chunk");
@@ -200,7 +566,6 @@ uint32_t* detail::alloc_chunk()
     _thread.current_chunk = c;
 
     // update tdata()
-    auto& td = tdata();
     td.curr = c->data();
     td.end = c->data() + c->capacity() - CTRACER_TRACE_SIZE;
 
@@ -208,41 +573,128 @@ uint32_t* detail::alloc_chunk()
     return td.curr;
 }
 
-void visit(trace const& t, visitor& v)
+uint32_t* detail::alloc_trace_chunk(location const* loc)
 {
-    auto idx = 0u;
-    auto const& d = t._data;
+    auto const is_begin = loc != nullptr;
 
-    // get next word
-    auto get = [&]() -> uint32_t {
-        if (idx >= d.size())
-            return 0;
-        return d[idx++];
-    };
-
-    while (true)
+    if (_thread.is_initialized && _thread.current_scope->_dropped_depth > 0)
     {
-        auto v0 = get();
-        if (v0 == 0x0)
-            return; // rest is not done
+        // inside a dropped subtree, even if memory is available again
+        _thread.current_scope->_dropped_events++;
+        _global.dropped_events++;
+    }
+    else
+    {
+        auto pd = alloc_chunk();
+        auto& s = *_thread.current_scope;
+
+        // dropped ends of recorded begins come first, otherwise the next end would close the wrong TRACE
+        size_t written = 0;
+        while (pd != nullptr && written < s._pending_ends.size())
+        {
+            if (pd >= tdata().end)
+            {
+                pd = alloc_chunk();
+                continue;
+            }
+
+            auto const& e = s._pending_ends[written++];
+            pd[0] = CTRACER_END_VALUE;
+            pd[1] = uint32_t(e.cycles);
+            pd[2] = uint32_t(e.cycles >> 32);
+            pd[3] = e.cpu;
+            pd += 4;
+            tdata().curr = pd;
+
+            s._dropped_events--;
+            _global.dropped_events--;
+        }
+        if (written > 0)
+        {
+            for (size_t i = written; i < s._pending_ends.size(); ++i)
+                s._pending_ends[i - written] = s._pending_ends[i];
+            s._pending_ends.resize(s._pending_ends.size() - written);
+        }
+
+        if (pd != nullptr && pd >= tdata().end)
+            pd = alloc_chunk();
+        if (pd != nullptr)
+            return pd;
+
+        if (!is_begin)
+        {
+            // its begin is already recorded (the end is counted as dropped until it is written)
+            uint32_t cpu;
+            auto const cycles = current_cycles(cpu);
+            s._pending_ends.push_back({cycles, cpu});
+            return nullptr;
+        }
+    }
 
-        if (v0 != CTRACER_END_VALUE)
+    auto& s = *_thread.current_scope;
+    auto& stack = _thread.aggregate_stack;
+    if (is_begin)
+    {
+        ++s._dropped_depth;
+        if (_global.budget_policy.load() == memory_budget_policy::aggregate)
         {
-            auto v1 = get();
-            auto loc = (location const*)(((uint64_t)v1 << 32uLL) | v0);
-            auto lo = get();
-            auto hi = get();
-            auto cpu = get();
-            auto cycles = ((uint64_t)hi << 32) | lo;
-            v.on_trace_start(*loc, cycles, cpu);
+            // recursive TRACE_SAMPLEDs share the weight of the outermost one (see raii_sampled_tracer)
+            auto const parent_weight = !stack.empty() && stack.back().s == &s ? stack.back().weight : 1;
+            auto is_recursive = false;
+            for (auto const& e : stack)
+                is_recursive = is_recursive || e.loc == loc;
+            stack.push_back({&s, s._dropped_depth, loc, current_cycles(), parent_weight * (is_recursive ? 1 : loc->sample_period), 0});
         }
+        return nullptr;
+    }
+
+    if (!stack.empty() && stack.back().s == &s && stack.back().depth == s._dropped_depth)
+    {
+        auto const t = stack.back();
+        stack.pop_back();
+        auto const dt = current_cycles() - t.cycles;
+
+        auto& l = _thread.aggregated_stats[t.loc];
+        l.loc = t.loc;
+        l.samples++;
+        l.counted_samples++;
+        l.total_cycles += dt;
+        l.descendants += t.descendants;
+        l.estimated_samples += t.weight;
+        l.estimated_total_cycles += t.weight * dt;
+        l.cycles_histogram.add(dt);
+
+        if (!stack.empty())
+            stack.back().descendants += 1 + t.descendants;
         else
         {
-            auto lo = get();
-            auto hi = get();
-            auto cpu = get();
-            auto cycles = ((uint64_t)hi << 32) | lo;
-            v.on_trace_end(cycles, cpu);
+            _global.mutex.lock();
+            for (auto const& kvp : _thread.aggregated_stats)
+                _global.aggregated_stats[kvp.first].merge(kvp.second);
+            _global.mutex.unlock();
+            _thread.aggregated_stats.clear();
+        }
+    }
+    --s._dropped_depth;
+    return nullptr;
+}
+
+void visit(trace const& t, visitor& v)
+{
+    size_t idx = 0;
+    size_t depth = 0;
+    detail::record r;
+    while (detail::decode_record(t._data.data(), t._data.size(), idx, r))
+    {
+        if (!r.is_end)
+        {
+            v.on_trace_start(*r.loc, r.cycles, r.cpu);
+            ++depth;
+        }
+        else if (depth > 0) // incomplete traces can contain ends whose begin was dropped
+        {
+            v.on_trace_end(r.cycles, r.cpu);
+            --depth;
         }
     }
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 
 #include <clean-core/macros.hh>
@@ -30,12 +31,35 @@
  *    TRACE_END();
  *
  *    NOTE: proper nesting must be respected
+ *
+ * Sampled version for very hot code:
+ *    TRACE_SAMPLED(64, "optional name");
+ *
+ *    records every 64th execution (per thread) including all nested TRACEs, the others cost ~5 cycles and skip the whole subtree
+ *    recursive executions are recorded (or skipped) together with the outermost one
+ *    location stats report estimated counts and totals scaled by the sampling weight (see location_stats::estimated_samples)
+ *
+ * Each TRACE() location can be disabled at runtime (see ct::disable_location in trace-config.hh),
+ * the check is a single load of a per-location byte. TRACE_BEGIN/TRACE_END are always recorded.
+ * A disabled TRACE_SAMPLED skips its whole subtree.
  */
-#define TRACE(...)                                                                                                                 \
-    (void)__VA_ARGS__ " has to be a string literal";                                                                               \
-    static constexpr ct::location CC_MACRO_JOIN(_ct_trace_label, __LINE__) = {__FILE__, CC_PRETTY_FUNC, "" __VA_ARGS__, __LINE__}; \
+#define TRACE(...)                                                                                                           \
+    (void)__VA_ARGS__ " has to be a string literal";                                                                         \
+    static ct::detail::location_state CC_MACRO_JOIN(_ct_trace_state, __LINE__) = {ct::detail::location_state::unregistered}; \
+    static constexpr ct::location CC_MACRO_JOIN(_ct_trace_label, __LINE__)                                                   \
+        = {__FILE__, CC_PRETTY_FUNC, "" __VA_ARGS__, __LINE__, &CC_MACRO_JOIN(_ct_trace_state, __LINE__)};                   \
     ct::detail::raii_tracer CC_MACRO_JOIN(_ct_trace_, __LINE__)(&CC_MACRO_JOIN(_ct_trace_label, __LINE__))
 
+#define TRACE_SAMPLED(n, ...)                                                                                                \
+    static_assert((n) >= 1, "sample period must be at least 1");                                                             \
+    (void)__VA_ARGS__ " has to be a string literal";                                                                         \
+    static ct::detail::location_state CC_MACRO_JOIN(_ct_trace_state, __LINE__) = {ct::detail::location_state::unregistered}; \
+    static constexpr ct::location CC_MACRO_JOIN(_ct_trace_label, __LINE__)                                                   \
+        = {__FILE__, CC_PRETTY_FUNC, "" __VA_ARGS__, __LINE__, &CC_MACRO_JOIN(_ct_trace_state, __LINE__), (n)};              \
+    static thread_local ct::detail::sampled_site CC_MACRO_JOIN(_ct_trace_site, __LINE__);                                    \
+    ct::detail::raii_sampled_tracer CC_MACRO_JOIN(_ct_trace_, __LINE__)(&CC_MACRO_JOIN(_ct_trace_label, __LINE__),           \
+                                                                       CC_MACRO_JOIN(_ct_trace_site, __LINE__))
+
 #define TRACE_BEGIN(...)                                                                                                           \
     (void)__VA_ARGS__ " has to be a string literal";                                                                               \
     static constexpr ct::location CC_MACRO_JOIN(_ct_trace_label, __LINE__) = {__FILE__, CC_PRETTY_FUNC, "" __VA_ARGS__, __LINE__}; \
@@ -51,16 +75,41 @@
 
 namespace ct
 {
+namespace detail
+{
+/// runtime state of a TRACE() location (see ct::disable_location)
+struct location_state
+{
+    enum : uint8_t
+    {
+        enabled = 0,
+        unregistered = 1, ///< not executed yet, first execution registers the location (and applies rules)
+        disabled = 2,
+    };
+
+    std::atomic<uint8_t> mode; ///< written by other threads (see ct::disable_location), read with relaxed loads
+};
+}
+
 struct location
 {
     char const* file;
     char const* function;
     char const* name;
     int line;
+    detail::location_state* state = nullptr; ///< only set for TRACE(), nullptr for TRACE_BEGIN
+    uint32_t sample_period = 1;              ///< TRACE_SAMPLED: one recorded execution represents this many
 };
 
 #ifdef _WIN32
 CC_FORCE_INLINE uint64_t current_cycles() { return __rdtsc(); }
+CC_FORCE_INLINE uint64_t current_cycles(uint32_t& cpu)
+{
+    unsigned int core;
+    auto cc = __rdtscp(&core);
+    cpu = core;
+    return cc;
+}
 #else //  Linux/GCC
 CC_FORCE_INLINE uint64_t current_cycles()
 {
@@ -68,6 +117,14 @@ CC_FORCE_INLINE uint64_t current_cycles()
     __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
     return ((uint64_t)hi << 32) | lo;
 }
+/// same as current_cycles() but also returns the processor id (via rdtscp)
+CC_FORCE_INLINE uint64_t current_cycles(uint32_t& cpu)
+{
+    unsigned int lo, hi, core;
+    __asm__ __volatile__("rdtscp" : "=a"(lo), "=d"(hi), "=c"(core));
+    cpu = core;
+    return ((uint64_t)hi << 32) | lo;
+}
 #endif
 
 namespace detail
@@ -76,22 +133,40 @@ struct thread_data
 {
     uint32_t* curr;
     uint32_t* end; ///< not actually end, has a CTRACER_TRACE_SIZE buffer at the end
+    bool discard;  ///< set by null_scope (curr and end are nullptr then so only the slow path checks this)
 };
 
+/// registers loc on its first execution, returns true if it is enabled
+CC_COLD_FUNC CC_DONT_INLINE bool register_location(location const* loc);
+
+/// relaxed, a plain byte load on all supported platforms
+CC_FORCE_INLINE uint8_t location_mode(location const* loc) { return loc->state->mode.load(std::memory_order_relaxed); }
+
 /// allocates a new chunk, returns "curr" and updates tdata()
+/// returns nullptr if the event has to be dropped (memory budget exhausted, see set_memory_budget)
 CC_COLD_FUNC CC_DONT_INLINE uint32_t* alloc_chunk();
 
+/// slow path of trace_begin (loc) and trace_end (nullptr), same as alloc_chunk
+/// but also drops all events up to the end of a dropped begin (otherwise that end would close the enclosing TRACE)
+CC_COLD_FUNC CC_DONT_INLINE uint32_t* alloc_trace_chunk(location const* loc);
+
 CC_FORCE_INLINE thread_data& tdata()
 {
-    static thread_local thread_data data = {nullptr, nullptr};
+    static thread_local thread_data data = {nullptr, nullptr, false};
     return data;
 }
 
 CC_FORCE_INLINE void trace_begin(location const* loc)
 {
     auto pd = tdata().curr;
-    if CC_CONDITION_UNLIKELY (pd >= tdata().end) // alloc new chunk
-        pd = alloc_chunk();
+    if CC_CONDITION_UNLIKELY (pd >= tdata().end) // alloc new chunk (or discard)
+    {
+        if (tdata().discard)
+            return;
+        pd = alloc_trace_chunk(loc);
+        if (!pd)
+            return;
+    }
     tdata().curr = pd + 5;
 
     *(location const**)pd = loc;
@@ -112,8 +187,14 @@ CC_FORCE_INLINE void trace_begin(location const* loc)
 CC_FORCE_INLINE void trace_end()
 {
     auto pd = tdata().curr;
-    if CC_CONDITION_UNLIKELY (pd >= tdata().end) // alloc new chunk
-        pd = alloc_chunk();
+    if CC_CONDITION_UNLIKELY (pd >= tdata().end) // alloc new chunk (or discard)
+    {
+        if (tdata().discard)
+            return;
+        pd = alloc_trace_chunk(nullptr);
+        if (!pd)
+            return;
+    }
     tdata().curr = pd + 4;
 
     unsigned int core;
@@ -133,8 +214,89 @@ CC_FORCE_INLINE void trace_end()
 
 struct raii_tracer
 {
-    CC_FORCE_INLINE raii_tracer(location const* loc) { trace_begin(loc); }
-    CC_FORCE_INLINE ~raii_tracer() { trace_end(); }
+    CC_FORCE_INLINE raii_tracer(location const* loc)
+    {
+        if CC_CONDITION_UNLIKELY (location_mode(loc) != location_state::enabled)
+        {
+            if (location_mode(loc) == location_state::disabled || !register_location(loc))
+            {
+                _active = false;
+                return;
+            }
+        }
+        trace_begin(loc);
+    }
+    CC_FORCE_INLINE ~raii_tracer()
+    {
+        if (_active) // the location might be disabled in-between
+            trace_end();
+    }
+
+private:
+    bool _active = true;
+};
+
+/// per-thread state of a TRACE_SAMPLED location
+struct sampled_site
+{
+    uint32_t countdown = 1;      ///< first execution is recorded
+    uint32_t recorded_depth = 0; ///< recorded executions on the stack (> 1 for recursion)
+};
+
+struct raii_sampled_tracer
+{
+    CC_FORCE_INLINE raii_sampled_tracer(location const* loc, sampled_site& site)
+    {
+        auto& td = tdata();
+        if (td.discard) // inside a skipped subtree (or null_scope), nested countdowns only advance for recorded parents
+            return;
+
+        // recursive executions inside a recorded one belong to its sample (and get no extra weight, see location_stats)
+        auto const is_recursive = site.recorded_depth > 0;
+        auto const is_sample = is_recursive || --site.countdown == 0;
+        if (is_sample && !is_recursive)
+            site.countdown = loc->sample_period;
+
+        // a disabled location skips its subtree as well, otherwise nested TRACEs would be recorded without the sampling weight
+        if (!is_sample || (location_mode(loc) != location_state::enabled && (location_mode(loc) == location_state::disabled || !register_location(loc))))
+        {
+            // skip the whole subtree: all nested TRACEs take the discard branch
+            // (curr is kept so the size of the current chunk stays correct)
+            _saved_end = td.end;
+            td.end = nullptr;
+            td.discard = true;
+            _mode = skipped;
+            return;
+        }
+
+        trace_begin(loc);
+        ++site.recorded_depth;
+        _site = &site;
+        _mode = recorded;
+    }
+    CC_FORCE_INLINE ~raii_sampled_tracer()
+    {
+        if (_mode == recorded)
+        {
+            trace_end();
+            --_site->recorded_depth;
+        }
+        else if (_mode == skipped)
+        {
+            tdata().end = _saved_end;
+            tdata().discard = false;
+        }
+    }
+
+private:
+    enum : uint8_t
+    {
+        inactive,
+        skipped,
+        recorded,
+    } _mode = inactive;
+    uint32_t* _saved_end = nullptr;
+    sampled_site* _site = nullptr;
 };
 } // namespace detail
 
@@ -0,0 +1,204 @@
+#include <ctracer/trace-config.hh>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#include <clean-core/map.hh>
+
+#include "detail.hh"
+
+namespace ct
+{
+namespace
+{
+struct location_rule
+{
+    cc::unique_function<bool(location const&)> predicate;
+    bool enable;
+};
+
+struct location_info
+{
+    int64_t window = 0;         ///< latest one-second throttle window (see location_registry::calibration_cycles)
+    uint64_t window_events = 0; ///< TRACEs in that window
+    bool is_throttled = false;
+};
+
+struct location_registry
+{
+    std::mutex mutex;
+    cc::vector<location const*> locations; // all executed TRACE() locations
+    cc::vector<location_rule> rules;
+    cc::map<location const*, location_info> infos;
+    cc::vector<location const*> throttled;
+
+    std::atomic<uint64_t> max_events_per_second{0};
+
+    // throttle windows are counted in seconds since these (never changed, so readable without the mutex)
+    std::chrono::steady_clock::time_point const calibration_time = std::chrono::steady_clock::now();
+    uint64_t const calibration_cycles = current_cycles();
+
+    // NOTE: mutex must be locked
+    bool is_enabled(location const& loc)
+    {
+        if (infos.contains_key(&loc) && infos[&loc].is_throttled)
+            return false;
+
+        auto enabled = true;
+        for (auto const& r : rules)
+            if (r.predicate(loc))
+                enabled = r.enable;
+        return enabled;
+    }
+
+    // NOTE: mutex must be locked
+    void update_mode(location const& loc)
+    {
+        loc.state->mode.store(is_enabled(loc) ? detail::location_state::enabled : detail::location_state::disabled, std::memory_order_relaxed);
+    }
+
+    void add_rule(cc::unique_function<bool(location const&)> predicate, bool enable)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        rules.push_back({cc::move(predicate), enable});
+        for (auto loc : locations)
+            update_mode(*loc);
+    }
+};
+
+location_registry& registry()
+{
+    static location_registry r;
+    return r;
+}
+
+cc::unique_function<bool(location const&)> file_line_predicate(cc::string_view file, int line)
+{
+    return [file = std::string(file.data(), file.size()), line](location const& loc)
+    {
+        if (loc.line != line)
+            return false;
+        auto const len = std::char_traits<char>::length(loc.file);
+        return len >= file.size() && file.compare(0, file.size(), loc.file + (len - file.size())) == 0;
+    };
+}
+}
+
+bool detail::register_location(location const* loc)
+{
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    if (location_mode(loc) == location_state::unregistered) // might have been registered by another thread
+    {
+        r.locations.push_back(loc);
+        r.update_mode(*loc);
+    }
+    return location_mode(loc) == location_state::enabled;
+}
+
+bool detail::is_location_throttle_enabled() { return registry().max_events_per_second.load(std::memory_order_relaxed) > 0; }
+
+void detail::throttle_hot_locations(uint32_t const* data, size_t size)
+{
+    auto& r = registry();
+
+    // cycles -> seconds, calibrated over the lifetime of the registry
+    auto const elapsed_cycles = current_cycles() - r.calibration_cycles;
+    auto const elapsed_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - r.calibration_time).count();
+    if (elapsed_seconds < 1e-3 || elapsed_cycles == 0)
+        return; // too early for a meaningful calibration
+    auto const seconds_per_cycle = elapsed_seconds / double(elapsed_cycles);
+
+    // count per location and one-second window of the record timestamps without touching shared state
+    // (a chunk can span anything from microseconds to hours, so its event count alone is not a rate)
+    struct window_count
+    {
+        location const* loc;
+        int64_t window;
+        uint64_t events;
+    };
+    static thread_local cc::vector<window_count> counts;             // per location in window order
+    static thread_local cc::map<location const*, size_t> last_count; // index into counts
+    counts.clear();
+    last_count.clear();
+    size_t idx = 0;
+    record rec;
+    while (decode_record(data, size, idx, rec))
+        if (!rec.is_end && rec.loc->state != nullptr)
+        {
+            auto const window = int64_t(std::floor(double(int64_t(rec.cycles - r.calibration_cycles)) * seconds_per_cycle));
+            if (!last_count.contains_key(rec.loc) || counts[last_count[rec.loc]].window != window)
+            {
+                last_count[rec.loc] = counts.size();
+                counts.push_back({rec.loc, window, 0});
+            }
+            ++counts[last_count[rec.loc]].events;
+        }
+
+    std::lock_guard<std::mutex> lock(r.mutex);
+    auto const max_events = r.max_events_per_second.load();
+    if (max_events == 0)
+        return;
+
+    for (auto const& w : counts)
+    {
+        // events of all threads are summed per window, older windows (e.g. chunks of other threads) are already over
+        auto& info = r.infos[w.loc];
+        if (w.window > info.window)
+        {
+            info.window = w.window;
+            info.window_events = 0;
+        }
+        if (w.window == info.window)
+            info.window_events += w.events;
+        if (info.is_throttled || info.window_events <= max_events)
+            continue;
+
+        info.is_throttled = true;
+        r.throttled.push_back(w.loc);
+        r.update_mode(*w.loc);
+        std::cerr << "[ctracer] Throttled location " << w.loc->file << ":" << w.loc->line //
+                  << " (more than " << max_events << " events per second)\n";
+    }
+}
+
+void disable_location(cc::string_view file, int line) { registry().add_rule(file_line_predicate(file, line), false); }
+void enable_location(cc::string_view file, int line) { registry().add_rule(file_line_predicate(file, line), true); }
+void disable_locations(cc::unique_function<bool(location const&)> predicate) { registry().add_rule(cc::move(predicate), false); }
+void enable_locations(cc::unique_function<bool(location const&)> predicate) { registry().add_rule(cc::move(predicate), true); }
+
+void enable_all_locations()
+{
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.rules.clear();
+    r.infos.clear();
+    r.throttled.clear();
+    for (auto loc : r.locations)
+        r.update_mode(*loc);
+}
+
+void set_location_throttle(uint64_t max_events_per_second)
+{
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.max_events_per_second = max_events_per_second;
+    for (auto loc : r.locations)
+        if (r.infos.contains_key(loc))
+            r.infos[loc].window_events = 0;
+}
+
+cc::vector<location const*> get_throttled_locations()
+{
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    cc::vector<location const*> locs;
+    for (auto loc : r.throttled)
+        locs.push_back(loc);
+    return locs;
+}
+}
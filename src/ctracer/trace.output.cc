@@ -10,9 +10,11 @@
 
 #include <fstream>
 
+#include "detail.hh"
+
 namespace ct
 {
-static cc::string format_cycles(double cycles, double to_sec_factor, print_unit unit)
+cc::string detail::format_cycles(double cycles, double to_sec_factor, print_unit unit)
 {
     switch (unit)
     {
@@ -83,6 +85,13 @@ static std::string beautify_function_name(std::string const& name)
     return name.substr(i + 1);
 }
 
+cc::string detail::location_name(location const& loc)
+{
+    if (loc.name && loc.name[0] != '\0')
+        return loc.name;
+    return beautify_function_name(loc.function).c_str();
+}
+
 void write_speedscope_json(cc::string_view filename, size_t max_events)
 {
     return write_speedscope_json(ct::get_current_thread_trace(), filename, max_events);
@@ -311,7 +320,9 @@ void write_chrome_tracing_json(trace const& tr, cc::string_view filename, size_t
     out << s.c_str();
 }
 
-void write_summary_csv(cc::string_view filename)
+void write_summary_csv(cc::string_view filename) { write_summary_csv(ct::get_current_thread_trace(), filename); }
+
+void write_summary_csv(trace const& t, cc::string_view filename)
 {
     std::ofstream out(cc::string(filename).c_str());
     if (!out.good())
@@ -322,8 +333,13 @@ void write_summary_csv(cc::string_view filename)
         int count = 0;
         uint64_t cycles_total = 0;
         uint64_t cycles_children = 0;
+        uint64_t descendants = 0;
+        uint64_t children = 0;
         uint64_t cycles_min = std::numeric_limits<uint64_t>::max();
         uint64_t cycles_max = 0;
+        histogram cycles_histogram;
+        uint64_t estimated_count = 0; // scaled by the TRACE_SAMPLED weight
+        uint64_t estimated_total = 0;
     };
 
     struct stack_entry
@@ -331,6 +347,9 @@ void write_summary_csv(cc::string_view filename)
         location const* loc;
         uint64_t cycles;
         uint64_t cycles_children;
+        uint64_t descendants;
+        uint64_t children;
+        uint64_t weight;
     };
 
     struct visitor : ct::visitor
@@ -341,8 +360,11 @@ void write_summary_csv(cc::string_view filename)
 
         virtual void on_trace_start(ct::location const& loc, uint64_t cycles, uint32_t /*cpu*/) override
         {
-            //
-            stack.push_back({&loc, cycles, 0});
+            // recursive TRACE_SAMPLEDs are recorded together with the outermost one and share its weight
+            auto const is_recursive
+                = loc.sample_period > 1 && std::any_of(stack.begin(), stack.end(), [&](stack_entry const& e) { return e.loc == &loc; });
+            auto const weight = (stack.empty() ? 1 : stack.back().weight) * (is_recursive ? 1 : loc.sample_period);
+            stack.push_back({&loc, cycles, 0, 0, 0, weight});
         }
         virtual void on_trace_end(uint64_t cycles, uint32_t /*cpu*/) override
         {
@@ -354,17 +376,32 @@ void write_summary_csv(cc::string_view filename)
             e.count++;
             e.cycles_total += dt;
             e.cycles_children += se.cycles_children;
+            e.descendants += se.descendants;
+            e.children += se.children;
             e.cycles_min = std::min(e.cycles_min, dt);
             e.cycles_max = std::max(e.cycles_max, dt);
+            e.cycles_histogram.add(dt);
+            e.estimated_count += se.weight;
+            e.estimated_total += se.weight * dt;
 
             if (!stack.empty())
+            {
                 stack.back().cycles_children += dt;
+                stack.back().descendants += se.descendants + 1;
+                stack.back().children++;
+            }
         }
     };
     visitor v;
-    visit(ct::get_current_thread_trace(), v);
+    visit(t, v);
+
+    // compensated: without the calibrated TRACE overhead of the samples and their descendants
+    // (the body contains the overhead of direct children minus their recorded part)
+    auto const& overhead = get_tracer_overhead();
+    auto const compensate = [](double cycles, double overhead_cycles) { return uint64_t(std::max(0.0, cycles - overhead_cycles)); };
 
-    out << "name,file,function,count,total,avg,min,max,total_body,avg_body\n";
+    out << "name,file,function,count,total,avg,min,max,p50,p90,p99,p999,total_body,avg_body,"
+           "descendants,total_compensated,avg_compensated,total_body_compensated,avg_body_compensated,estimated_count,estimated_total\n";
     for (auto const& kvp : v.entries)
     {
         auto l = kvp.first;
@@ -377,21 +414,43 @@ void write_summary_csv(cc::string_view filename)
         out << e.cycles_total / e.count << ",";
         out << e.cycles_min << ",";
         out << e.cycles_max << ",";
+        out << e.cycles_histogram.p50() << ",";
+        out << e.cycles_histogram.p90() << ",";
+        out << e.cycles_histogram.p99() << ",";
+        out << e.cycles_histogram.p999() << ",";
         out << e.cycles_total - e.cycles_children << ",";
-        out << (e.cycles_total - e.cycles_children) / e.count;
+        out << (e.cycles_total - e.cycles_children) / e.count << ",";
+
+        auto const total_comp = compensate(double(e.cycles_total), e.count * overhead.empty_cycles + e.descendants * overhead.nested_cycles);
+        auto const body_comp = compensate(double(e.cycles_total - e.cycles_children),
+                                          e.count * overhead.empty_cycles + e.children * (overhead.nested_cycles - overhead.empty_cycles));
+        out << e.descendants << ",";
+        out << total_comp << ",";
+        out << total_comp / e.count << ",";
+        out << body_comp << ",";
+        out << body_comp / e.count << ",";
+        out << e.estimated_count << ",";
+        out << e.estimated_total;
         out << "\n";
     }
 }
 
 void print_location_stats(trace const& t, int max_locs, print_unit unit)
 {
+    using detail::format_cycles;
+
     auto locs = t.compute_location_stats();
-    std::sort(locs.begin(), locs.end(), [](location_stats const& a, location_stats const& b) { return a.total_cycles > b.total_cycles; });
+    std::sort(locs.begin(), locs.end(),
+              [](location_stats const& a, location_stats const& b) { return a.estimated_total_cycles > b.estimated_total_cycles; });
 
     if (int(locs.size()) < max_locs)
         max_locs = int(locs.size());
 
     auto const cc_to_sec = t.elapsed_seconds() / t.elapsed_cycles();
+    auto const& overhead = get_tracer_overhead();
+
+    if (t.is_incomplete())
+        std::cout << "[ctracer] incomplete trace: " << t.dropped_events() << " events were dropped due to the memory budget" << std::endl;
 
     for (auto i = 0; i < max_locs; ++i)
     {
@@ -400,8 +459,14 @@ void print_location_stats(trace const& t, int max_locs, print_unit unit)
         auto name = std::string(l.loc->name ? l.loc->name : "");
         if (name.empty())
             name = beautify_function_name(l.loc->function);
-        std::cout << format_cycles(l.total_cycles, cc_to_sec, unit).c_str() << " (" << l.samples << "x, "
-                  << format_cycles(l.total_cycles / l.samples, cc_to_sec, unit).c_str() << " / sample) " << name << std::endl;
+        std::cout << format_cycles(l.total_cycles, cc_to_sec, unit).c_str() << " (compensated "
+                  << format_cycles(l.compensated_total_cycles(overhead), cc_to_sec, unit).c_str() << ", " << l.samples << "x, "
+                  << format_cycles(l.total_cycles / l.samples, cc_to_sec, unit).c_str() << " / sample, p50 "
+                  << format_cycles(l.p50_cycles(), cc_to_sec, unit).c_str() << ", p99 " << format_cycles(l.p99_cycles(), cc_to_sec, unit).c_str()
+                  << ") " << name;
+        if (l.estimated_samples != uint64_t(l.samples)) // TRACE_SAMPLED
+            std::cout << " [estimated " << format_cycles(l.estimated_total_cycles, cc_to_sec, unit).c_str() << ", " << l.estimated_samples << "x]";
+        std::cout << std::endl;
     }
 }
 } // namespace ct
@@ -0,0 +1,334 @@
+/*
+ * ctracer-live: watches the traces of a running process (see ct::start_live_export)
+ *
+ * Usage:
+ *   ctracer-live [<name>] [--interval <ms>] [--top <n>]
+ *
+ * Attaches read-only to the shared-memory segment <name> (default: /ctracer) and prints the location stats
+ * (as in ct::print_location_stats) of all threads for every interval.
+ * TRACEs are counted in the interval in which they end.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <ctracer/detail.hh>
+#include <ctracer/live-export.hh>
+#include <ctracer/trace-config.hh>
+#include <ctracer/trace-container.hh>
+
+namespace
+{
+/// records the TRACEs that are still open at the end of the visited data
+struct open_scope_visitor : ct::visitor
+{
+    struct open_scope
+    {
+        ct::location const* loc;
+        uint64_t cycles;
+        uint32_t cpu;
+    };
+
+    std::vector<open_scope> stack;
+
+    void on_trace_start(ct::location const& loc, uint64_t cycles, uint32_t cpu) override { stack.push_back({&loc, cycles, cpu}); }
+    void on_trace_end(uint64_t, uint32_t) override { stack.pop_back(); } // visit() skips unmatched ends
+};
+
+struct thread_reader
+{
+    std::string name;
+    uint64_t pos = 0; ///< next dword to read (in ring head units)
+    std::vector<open_scope_visitor::open_scope> open;
+};
+
+struct live_reader
+{
+    char const* base = nullptr;
+    size_t size = 0;
+
+    std::deque<std::string> strings;
+    std::deque<ct::location> locations; // stable addresses for ct::trace
+    std::vector<thread_reader> threads;
+    uint64_t lost_dwords = 0; ///< in the current interval
+    uint64_t records = 0; ///< read in the current interval
+    std::map<ct::location const*, ct::location_stats> merged; ///< of the current interval
+
+    ct::live::header const& header() const { return *reinterpret_cast<ct::live::header const*>(base); }
+    template <class T>
+    T const* at(uint64_t offset) const
+    {
+        return reinterpret_cast<T const*>(base + offset);
+    }
+
+    char const* string_at(uint32_t offset)
+    {
+        strings.emplace_back(at<char>(header().strings_offset + offset));
+        return strings.back().c_str();
+    }
+
+    void update_tables()
+    {
+        auto const& h = header();
+
+        auto const loc_cnt = h.location_count.load(std::memory_order_acquire);
+        while (locations.size() < loc_cnt)
+        {
+            auto const& e = at<ct::live::location_entry>(h.locations_offset)[locations.size()];
+            ct::location loc = {string_at(e.file), string_at(e.function), string_at(e.name), e.line};
+            loc.sample_period = e.sample_period;
+            locations.push_back(loc);
+        }
+
+        auto const thread_cnt = h.thread_count.load(std::memory_order_acquire);
+        while (threads.size() < thread_cnt)
+        {
+            auto const& e = at<ct::live::thread_entry>(h.threads_offset)[threads.size()];
+            thread_reader t;
+            t.name = std::string(e.name, strnlen(e.name, sizeof(e.name)));
+            t.pos = e.head.load(std::memory_order_acquire); // only new data
+            threads.push_back(std::move(t));
+        }
+    }
+
+    /// reads all new records of a thread and returns them as a trace (prefixed by the TRACEs that were open before)
+    ct::trace read_thread(size_t slot)
+    {
+        auto const& h = header();
+        auto const& e = at<ct::live::thread_entry>(h.threads_offset)[slot];
+        auto const ring = at<uint32_t>(h.rings_offset + slot * h.ring_dwords * sizeof(uint32_t));
+        auto const n = h.ring_dwords;
+        auto& t = threads[slot];
+
+        auto const head = e.head.load(std::memory_order_acquire);
+        update_tables(); // locations of the new records are visible now
+
+        std::vector<uint32_t> words;
+        words.reserve(head - t.pos);
+        for (auto i = t.pos; i < head; ++i)
+            words.push_back(ring[i % n]);
+
+        // the writer might have overwritten the data while (or before) it was copied
+        // (it reserves the range before writing, so any overwritten slot shows up in head_reserved)
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (e.head_reserved.load(std::memory_order_relaxed) - t.pos > n)
+        {
+            lost_dwords += head - t.pos;
+            words.clear();
+            t.open.clear();
+        }
+        t.pos = head;
+
+        cc::vector<uint32_t> data;
+        auto const add_begin = [&](ct::location const* loc, uint64_t cycles, uint32_t cpu)
+        {
+            data.push_back(uint32_t(uint64_t(loc)));
+            data.push_back(uint32_t(uint64_t(loc) >> 32));
+            data.push_back(uint32_t(cycles));
+            data.push_back(uint32_t(cycles >> 32));
+            data.push_back(cpu);
+        };
+
+        for (auto const& o : t.open)
+            add_begin(o.loc, o.cycles, o.cpu);
+
+        // exported begin records store the location index instead of the pointer
+        uint64_t cycles_start = t.open.empty() ? 0 : t.open.front().cycles;
+        uint64_t cycles_end = cycles_start;
+        for (size_t i = 0; i < words.size();)
+        {
+            auto const is_end = words[i] == CTRACER_END_VALUE;
+            auto const record_size = is_end ? 4u : 5u;
+            if (i + record_size > words.size())
+                break;
+
+            auto const w = words.data() + i + (is_end ? 1 : 2);
+            auto const cycles = uint64_t(w[0]) | uint64_t(w[1]) << 32;
+            if (is_end)
+            {
+                data.push_back(CTRACER_END_VALUE);
+                data.push_back(w[0]);
+                data.push_back(w[1]);
+                data.push_back(w[2]);
+            }
+            else
+            {
+                auto const id = words[i] - 1;
+                add_begin(&locations[id < locations.size() ? id : 0], cycles, w[2]);
+            }
+
+            if (cycles_start == 0)
+                cycles_start = cycles;
+            cycles_end = cycles;
+            ++records;
+            i += record_size;
+        }
+
+        return ct::trace(t.name.c_str(), cc::move(data), {}, {}, cycles_start, cycles_end);
+    }
+
+    /// reads the new records of all threads (often enough to keep up with the writer)
+    void poll()
+    {
+        update_tables();
+        for (size_t i = 0; i < threads.size(); ++i)
+        {
+            auto const t = read_thread(i);
+
+            for (auto const& s : t.compute_location_stats())
+            {
+                auto it = merged.find(s.loc);
+                if (it == merged.end())
+                    merged.emplace(s.loc, s);
+                else
+                    it->second.merge(s);
+            }
+
+            open_scope_visitor v;
+            ct::visit(t, v);
+            threads[i].open = std::move(v.stack);
+        }
+    }
+
+    /// prints and resets the stats of the current interval
+    void print_stats(int max_locs, double seconds)
+    {
+        using ct::detail::format_cycles;
+
+        auto const& h = header();
+
+        std::vector<ct::location_stats> locs;
+        for (auto& kvp : merged)
+            locs.push_back(std::move(kvp.second));
+        merged.clear();
+        std::sort(locs.begin(), locs.end(),
+                  [](ct::location_stats const& a, ct::location_stats const& b) { return a.estimated_total_cycles > b.estimated_total_cycles; });
+        if (int(locs.size()) < max_locs)
+            max_locs = int(locs.size());
+
+        // calibration of the writing process
+        auto const dc = h.last_cycles.load() - h.start_cycles.load();
+        auto const dns = h.last_nanoseconds.load() - h.start_nanoseconds.load();
+        auto const cc_to_sec = dc > 0 && dns > 0 ? double(dns) * 1e-9 / double(dc) : 1.0 / 3e9;
+        auto const unit = ct::print_unit::time;
+
+        std::cout << "--- " << seconds << " s, " << threads.size() << " threads, " << records << " records";
+        if (lost_dwords > 0)
+            std::cout << " (" << lost_dwords * sizeof(uint32_t) << " bytes lost, reader too slow or ring too small)";
+        std::cout << " ---" << std::endl;
+        records = 0;
+        lost_dwords = 0;
+
+        for (auto i = 0; i < max_locs; ++i)
+        {
+            auto const& l = locs[i];
+            std::cout << format_cycles(double(l.total_cycles), cc_to_sec, unit).c_str() << " (" << l.samples << "x, "
+                      << format_cycles(double(l.total_cycles) / l.samples, cc_to_sec, unit).c_str() << " / sample, p50 "
+                      << format_cycles(double(l.p50_cycles()), cc_to_sec, unit).c_str() << ", p99 "
+                      << format_cycles(double(l.p99_cycles()), cc_to_sec, unit).c_str() << ") " << ct::detail::location_name(*l.loc).c_str();
+            if (l.estimated_samples != uint64_t(l.samples)) // TRACE_SAMPLED
+                std::cout << " [estimated " << format_cycles(double(l.estimated_total_cycles), cc_to_sec, unit).c_str() << ", "
+                          << l.estimated_samples << "x]";
+            std::cout << std::endl;
+        }
+    }
+};
+
+#ifndef _WIN32
+bool attach(char const* name, live_reader& r)
+{
+    auto const fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    auto const base = fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(ct::live::header) //
+                          ? mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0)
+                          : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED)
+        return false;
+
+    auto const& h = *static_cast<ct::live::header const*>(base);
+    if (h.magic.load(std::memory_order_acquire) != ct::live::magic || h.version != ct::live::version || h.segment_bytes > size_t(st.st_size))
+    {
+        munmap(base, size_t(st.st_size));
+        return false;
+    }
+
+    r.base = static_cast<char const*>(base);
+    r.size = size_t(st.st_size);
+    return true;
+}
+#endif
+}
+
+int main(int argc, char** argv)
+{
+    char const* name = "/ctracer";
+    int interval_ms = 1000;
+    int top = 20;
+
+    for (auto i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--interval") == 0 && i + 1 < argc)
+            interval_ms = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--top") == 0 && i + 1 < argc)
+            top = std::atoi(argv[++i]);
+        else if (argv[i][0] != '-')
+            name = argv[i];
+        else
+        {
+            std::cerr << "usage: ctracer-live [<name>] [--interval <ms>] [--top <n>]" << std::endl;
+            return 1;
+        }
+    }
+
+#ifdef _WIN32
+    (void)name;
+    (void)interval_ms;
+    (void)top;
+    std::cerr << "ctracer-live is only supported on POSIX systems" << std::endl;
+    return 1;
+#else
+    live_reader reader;
+    if (!attach(name, reader))
+    {
+        std::cerr << "waiting for " << name << " (see ct::start_live_export) ..." << std::endl;
+        while (!attach(name, reader))
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+    }
+    reader.update_tables();
+
+    auto const poll_interval = std::chrono::milliseconds(std::min(interval_ms, 20));
+    auto last = std::chrono::steady_clock::now();
+    while (true)
+    {
+        std::this_thread::sleep_for(poll_interval);
+        reader.poll();
+
+        auto const now = std::chrono::steady_clock::now();
+        if (now - last >= std::chrono::milliseconds(interval_ms))
+        {
+            reader.print_stats(top, std::chrono::duration<double>(now - last).count());
+            last = now;
+        }
+    }
+#endif
+}